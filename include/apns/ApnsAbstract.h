@@ -68,6 +68,12 @@ namespace apns {
       const std::string generateRandomDeviceToken();
       const std::string char2hex(const char ch) { return _char2hex(ch); }
 
+      // Library wide threshold for APNS_LOG; anything less important is
+      // skipped before its arguments are built.
+      static void logLevel(const int logLevel) { _logLevel = logLevel; }
+      static const int logLevel() { return _logLevel; }
+      static const bool isLogLevel(const int level) { return level <= _logLevel; }
+
     protected:
 
       void _deviceTokenToBinary(char *, const std::string &, const size_t);
@@ -77,12 +83,28 @@ namespace apns {
       const bool _testDeviceTokenTools();
 
     private:
+      static int _logLevel;			// most verbose level we log at
   }; // class ApnsAbstract
 
 /**************************************************************************
  ** Macro's                                                              **
  **************************************************************************/
 
+// Builds with -DAPNS_LOG_MAXIMUM_LEVEL=LogNotice (configure
+// --with-max-log-level) compile anything more verbose out entirely.
+#ifndef APNS_LOG_MAXIMUM_LEVEL
+#define APNS_LOG_MAXIMUM_LEVEL LogDebug
+#endif
+
+// LOG, but the stream arguments are only evaluated when the level is
+// enabled, so debug output costs a compare when it is off.
+#define APNS_LOG(level, args) \
+  do { \
+    if ((level) <= openframe::loglevel::APNS_LOG_MAXIMUM_LEVEL \
+        && apns::ApnsAbstract::isLogLevel(level)) \
+      LOG(level, args); \
+  } while(0)
+
 /**************************************************************************
  ** Proto types                                                          **
  **************************************************************************/
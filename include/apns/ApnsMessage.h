@@ -29,6 +29,8 @@
 #include <set>
 #include <string>
 
+#include <stdint.h>
+
 #include "PushController.h"
 
 #include <exception>
@@ -76,6 +78,7 @@ namespace apns {
       static const unsigned int DEFAULT_MAXIMUM_RETRIES;
       static const unsigned int MAXIMUM_DICTIONARY_VALUES;
       static const unsigned int DEFAULT_EXPIRY;
+      static const unsigned int MAXIMUM_PAYLOAD_DEPTH;
 
       enum apnsEnvironmentEnum {
         APNS_ENVIRONMENT_DEVEL = 0,
@@ -101,7 +104,12 @@ namespace apns {
       const int BadgeNumber() const { return _badgeNumber; }
       void id(const unsigned int id) { _id = id; }
       const unsigned int id() const { return _id; }
+      // Charged each time its frame is lost with a connection that went
+      // down without an error response; frames put back behind another
+      // message's rejection, or when we hang up ourselves, are not.  A
+      // rejection is final and needs no retry.
       const unsigned int retries() { return _retries; }
+      const bool retriesExhausted() const { return _retries > _maxRetries; }
       const bool retry() {
         if (++_retries > _maxRetries)
           return false;
@@ -113,10 +121,16 @@ namespace apns {
       const time_t expiry() { return _expiry; }
 
       const std::string getPayload();
+      const std::string getPayload(const size_t);
+      void payload(std::string &);
+      const bool isRaw() const { return _raw; }
       const int error() const { return _error; }
 
+      static const bool isValidPayload(const char *, const size_t);
+
     protected:
       const std::string escape(const std::string &);
+      const std::string &_buildPayload(const size_t);
       void error(const int error) { _error = error; }
 
     private:
@@ -127,12 +141,17 @@ namespace apns {
       std::string _soundName;				// Sound name.
       std::string _actionKeyCaption;			// Action key caption.
       std::string _customIdentifier;			// Custom identifier.
+      std::string _payload;				// Encoded payload.
+      bool _raw;					// Payload was handed to us pre-built.
       int _badgeNumber;				// Badge number.
       int _error;					// Error number.
       unsigned int _id;				// Message Id.
       unsigned int _maxRetries;			// Max retires.
-      unsigned int _retries;			// Number of times message was retried.
+      unsigned int _retries;			// Times its frame was lost with a connection.
       time_t _expiry;				// Default expiration time.
+      uint64_t _queuedUs;				// When add() took it, monotonic.
+      uint64_t _writtenUs;			// When its frame was last written, monotonic.
+      bool _outcomeReported;			// Handed to the outcome handler already.
   }; // ApnsMessage
 
 /**************************************************************************
@@ -0,0 +1,96 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_DEADTOKENFILTER_H
+#define LIBAPNS_DEADTOKENFILTER_H
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "ApnsAbstract.h"
+#include "PushController.h"
+#include "FeedbackController.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Binary tokens APNs has told us are dead, each with when it said so,
+  // kept as one sorted array (40 bytes a token).  Fed from feedback polls
+  // and ERR_INVALID_TOKEN responses; PushController::add() refuses
+  // messages for anything in it.  A token the app registers again after
+  // it was reported is taken back out by registered().
+  //
+  // Shared between controllers, possibly on different threads.
+  class DeadTokenFilter : public ApnsAbstract, public FeedbackHandler {
+    public:
+      DeadTokenFilter();
+      virtual ~DeadTokenFilter();
+
+      typedef std::vector<FeedbackRecord> tokenVectorType;
+
+      /***************
+       ** Variables **
+       ***************/
+      void onFeedback(const FeedbackRecord *, const size_t);
+      void add(const std::string &, const time_t);
+      const bool registered(const std::string &, const time_t);
+      const bool isDead(const std::string &);
+      const bool isDead(const unsigned char *);
+      const size_t size();
+      void clear();
+
+      // Snapshots use the FeedbackLog format, so apnstest feedback-dump
+      // and FeedbackLogReader work on them too.
+      const size_t load(const std::string &);
+      const bool save(const std::string &);
+
+    protected:
+    private:
+      void _toBinary(FeedbackRecord &, const std::string &);
+      tokenVectorType::iterator _find(const unsigned char *);
+
+      pthread_mutex_t _mutex;			// guards _tokens
+      tokenVectorType _tokens;			// sorted by token, one record each
+  }; // DeadTokenFilter
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
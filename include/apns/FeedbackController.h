@@ -27,6 +27,7 @@
 #define LIBAPNS_FEEDBACKCONTROLLER_H
 
 #include <set>
+#include <vector>
 
 #include <netdb.h>
 #include <unistd.h>
@@ -59,6 +60,21 @@ namespace apns {
     char deviceToken[DEVICE_BINARY_SIZE];
   } ApnsFeedbackResponse_t;
 
+  typedef struct {
+    time_t timestamp;				// when APNs saw the token go stale
+    unsigned char deviceToken[DEVICE_BINARY_SIZE];	// binary, not hex
+  } FeedbackRecord;
+
+  // Receives each poll's feedback as one contiguous array, one record per
+  // token (the newest if APNs repeated it), sorted by token.  The array
+  // belongs to the controller and is only valid during the call.
+  class FeedbackHandler {
+    public:
+      virtual ~FeedbackHandler() { }
+
+      virtual void onFeedback(const FeedbackRecord *, const size_t) = 0;
+  }; // FeedbackHandler
+
   class FeedbackMessage {
     public:
       FeedbackMessage(const time_t timestamp, const unsigned int tokenLen, const std::string deviceToken) :
@@ -78,6 +94,9 @@ namespace apns {
       unsigned int _tokenLen;
   }; // FeedbackMessage
 
+  class FeedbackLog;
+  class DeadTokenFilter;
+
   class FeedbackController_Exception : public ApnsAbstract_Exception {
     public:
       FeedbackController_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
@@ -92,15 +111,41 @@ namespace apns {
        ** Type Definitions **
        **********************/
       static const int FEEDBACK_RESPONSE_SIZE;
+      static const size_t FEEDBACK_HEADER_SIZE;
+      static const size_t FEEDBACK_READ_BUFFER_SIZE;
+      static const time_t FEEDBACK_READ_TIMEOUT;
+      static const unsigned int FEEDBACK_BUSY_RECORDS;
 
       typedef std::set<FeedbackMessage *> messageQueueType;
 
       /***************
        ** Variables **
        ***************/
-      void timeout(const time_t timeout) { _timeout = timeout; }
+      void timeout(const time_t timeout) { _timeout = timeout; _pollInterval = timeout; }
       void testFeedbackResponse() { _testFeedbackResponse(); }
       const inline time_t timeout() { return _timeout; }
+      // The poll interval halves after a busy poll and doubles after an
+      // empty one within these bounds; 0 means a quarter of / four times
+      // the timeout.
+      void minimumPollInterval(const time_t minimumPollInterval) { _minimumPollInterval = minimumPollInterval; }
+      const inline time_t minimumPollInterval() const { return _minimumPollInterval; }
+      void maximumPollInterval(const time_t maximumPollInterval) { _maximumPollInterval = maximumPollInterval; }
+      const inline time_t maximumPollInterval() const { return _maximumPollInterval; }
+      const inline time_t pollInterval() const { return _pollInterval; }
+      const inline unsigned int lastPollRecords() const { return _lastPollRecords; }
+      // from the start of each poll's connect until it is done
+      const inline LatencyHistogram &pollLatency() const { return _pollLatency; }
+      // With a handler, log or filter set feedback bypasses the
+      // FeedbackMessage queue.
+      void feedbackHandler(FeedbackHandler *feedbackHandler) { _feedbackHandler = feedbackHandler; }
+      FeedbackHandler *feedbackHandler() const { return _feedbackHandler; }
+      // Each poll is appended to the log (after dedup) instead of being
+      // kept in memory; the controller doesn't take ownership.
+      void feedbackLog(FeedbackLog *feedbackLog) { _feedbackLog = feedbackLog; }
+      FeedbackLog *feedbackLog() const { return _feedbackLog; }
+      // Reported tokens are added to the filter; not owned.
+      void deadTokenFilter(DeadTokenFilter *deadTokenFilter) { _deadTokenFilter = deadTokenFilter; }
+      DeadTokenFilter *deadTokenFilter() const { return _deadTokenFilter; }
       const messageQueueType::size_type numQueue() { return _messageFeedbackQueue.size(); }
       const messageQueueType::size_type getQueue(messageQueueType &messageQueue) {
         messageQueue = _messageFeedbackQueue;
@@ -114,13 +159,30 @@ namespace apns {
     protected:
 
     private:
-      void _readFeedbackFromApns();
+      const unsigned int _readFeedbackFromApns();
+      void _finishPoll();
+      void _deliverRecords();
       void _testFeedbackResponse();
       void _processFeedbackFromApns(const ApnsFeedbackResponse_t *);
 
       messageQueueType _messageFeedbackQueue;	// storage for all feedback we receive
       time_t _timeout;				// timeout in seconds to close connection
       time_t _nextCheckTs;			// next time we check feedback service
+      time_t _pollInterval;			// current gap between polls
+      time_t _minimumPollInterval;		// lower bound for _pollInterval
+      time_t _maximumPollInterval;		// upper bound for _pollInterval
+      std::vector<char> _readBuffer;		// only allocated during a poll
+      size_t _readLength;			// bytes held in _readBuffer
+      bool _polling;				// connected and reading a response
+      time_t _lastReadTs;			// last time the response made progress
+      unsigned int _pollRecords;			// records read so far this poll
+      unsigned int _lastPollRecords;		// records the last complete poll read
+      uint64_t _pollStartUs;			// when this poll began, monotonic
+      LatencyHistogram _pollLatency;		// poll durations
+      FeedbackHandler *_feedbackHandler;		// if set, gets _records after each poll
+      FeedbackLog *_feedbackLog;			// if set, _records are appended after each poll
+      DeadTokenFilter *_deadTokenFilter;		// if set, _records are merged after each poll
+      std::vector<FeedbackRecord> _records;	// this poll's records, capacity is kept
   }; // class FeedbackController
 
 /**************************************************************************
@@ -131,5 +193,9 @@ namespace apns {
  ** Proto types                                                          **
  **************************************************************************/
 
+  // by token, newest first within a token
+  bool feedbackRecordLess(const FeedbackRecord &, const FeedbackRecord &);
+  bool feedbackRecordSameToken(const FeedbackRecord &, const FeedbackRecord &);
+
 } // namespace apns
 #endif
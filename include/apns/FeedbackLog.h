@@ -0,0 +1,150 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_FEEDBACKLOG_H
+#define LIBAPNS_FEEDBACKLOG_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ApnsAbstract.h"
+#include "PushController.h"
+#include "FeedbackController.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // On disk everything is network order, so logs move between hosts.
+  typedef struct {
+    char magic[8];				// FeedbackLog::MAGIC
+    char version[4];				// uint32_t
+    char recordSize[4];				// uint32_t, sizeof(FeedbackLog_Record_t)
+  } FeedbackLog_Header_t;
+
+  typedef struct {
+    char timestamp[4];				// uint32_t
+    char deviceToken[DEVICE_BINARY_SIZE];
+  } FeedbackLog_Record_t;
+
+  class FeedbackLog_Exception : public ApnsAbstract_Exception {
+    public:
+      FeedbackLog_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class FeedbackLog_Exception
+
+  // Append only log of feedback records: a fixed header followed by
+  // fixed size records, so a file can be mapped and indexed directly.
+  // A record torn by a crash is cut off when the log is reopened.
+  class FeedbackLog : public ApnsAbstract {
+    public:
+      enum fsyncPolicyEnum {
+        SYNC_NEVER	= 0,		// leave it to the kernel
+        SYNC_INTERVAL	= 1,		// at most once every syncInterval() seconds
+        SYNC_ALWAYS	= 2		// after every append
+      };
+
+      FeedbackLog(const std::string &, const fsyncPolicyEnum);
+      virtual ~FeedbackLog();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const char MAGIC[8];
+      static const uint32_t VERSION;
+      static const time_t DEFAULT_SYNC_INTERVAL;
+
+      /***************
+       ** Variables **
+       ***************/
+      void fsyncPolicy(const fsyncPolicyEnum fsyncPolicy) { _fsyncPolicy = fsyncPolicy; }
+      const inline fsyncPolicyEnum fsyncPolicy() const { return _fsyncPolicy; }
+      void syncInterval(const time_t syncInterval) { _syncInterval = syncInterval; }
+      const inline time_t syncInterval() const { return _syncInterval; }
+      const inline std::string path() const { return _path; }
+
+      const bool append(const FeedbackRecord *, const size_t);
+      const bool sync();
+
+    protected:
+    private:
+      void _open();
+      const bool _write(const char *, size_t);
+
+      std::string _path;				// log file
+      int _fd;					// opened O_APPEND
+      fsyncPolicyEnum _fsyncPolicy;		// when appends reach the disk
+      time_t _syncInterval;			// for SYNC_INTERVAL
+      time_t _lastSyncTs;				// last fsync
+      bool _dirty;				// written since the last fsync
+      std::vector<char> _buffer;			// encoded records, capacity is kept
+  }; // FeedbackLog
+
+  // Maps a feedback log read only; records() indexes straight into the
+  // mapping.  A record still being appended past the end is not counted.
+  class FeedbackLogReader {
+    public:
+      FeedbackLogReader(const std::string &);
+      virtual ~FeedbackLogReader();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const size_t SCAN_BATCH_SIZE;
+
+      /***************
+       ** Variables **
+       ***************/
+      const inline size_t size() const { return _numRecords; }
+      const inline FeedbackLog_Record_t *records() const { return _records; }
+      void record(const size_t, FeedbackRecord &) const;
+      const size_t scan(FeedbackHandler *) const;
+
+    protected:
+    private:
+      int _fd;					// log file
+      void *_map;					// whole file, read only
+      size_t _mapLength;
+      const FeedbackLog_Record_t *_records;	// first record in _map
+      size_t _numRecords;				// complete records
+  }; // FeedbackLogReader
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
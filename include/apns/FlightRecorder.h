@@ -0,0 +1,162 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_FLIGHTRECORDER_H
+#define LIBAPNS_FLIGHTRECORDER_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+#define FLIGHT_TOKEN_PREFIX_SIZE	8		// hex characters of the token kept
+#define FLIGHT_NAME_SIZE		64
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  enum flightEventEnum {
+    FLIGHT_CONNECTING		= 0,		// value: address attempt
+    FLIGHT_CONNECTED		= 1,		// value: tcp connect microseconds
+    FLIGHT_HANDSHAKE		= 2,		// value: tls handshake microseconds
+    FLIGHT_CONNECT_FAILED	= 3,		// status: connect state, value: errno
+    FLIGHT_IO_ERROR		= 4,		// status: SSL_get_error(), value: errno
+    FLIGHT_DISCONNECT		= 5,		// value: bytes flushed on the connection
+    FLIGHT_FRAME		= 6,		// id, token, status: retries, value: bytes
+    FLIGHT_ERROR_RESPONSE	= 7,		// id, status: APNs status
+    FLIGHT_REQUEUED		= 8,		// value: frames put back
+    FLIGHT_DEAD_PEER		= 9,		// value: bytes the peer left unacked
+    FLIGHT_IDLE_EXPIRED		= 10,		// value: seconds idle
+    FLIGHT_DRAINED		= 11,		// value: messages left unsent
+    FLIGHT_MAX_EVENT		= 12
+  };
+
+  // One 40 byte slot of the ring.  seq is the event's position plus one
+  // once it is complete and 0 while it is being written.
+  typedef struct {
+    uint64_t seq;
+    uint64_t us;				// monotonic microseconds
+    uint32_t id;				// frame identifier
+    uint32_t value;				// see flightEventEnum
+    uint16_t type;				// flightEventEnum
+    uint16_t status;				// see flightEventEnum
+    char token[FLIGHT_TOKEN_PREFIX_SIZE];	// start of the hex device token
+  } FlightRecorder_Event;
+
+  // Fixed ring of the most recent events of one connection, for working
+  // out after the fact what led up to a disconnect.  Recording is a few
+  // stores and never locks or allocates; there is one writer (the owning
+  // controller) and any number of readers, which skip slots overwritten
+  // while they looked.  dump() only uses async signal safe calls, so
+  // dumpOnSignal() can dump every live recorder from a signal handler.
+  //
+  // dumpAll() sees the first MAXIMUM_RECORDERS live recorders; any more
+  // still record and dump() but are left out of it, which
+  // numUnregistered() and the dumpAll() output own up to.  Destroying a
+  // recorder waits for a dumpAll() already under way to finish.
+  class FlightRecorder {
+    public:
+      FlightRecorder(const size_t);
+      virtual ~FlightRecorder();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const size_t DEFAULT_EVENTS;
+      static const size_t MAXIMUM_RECORDERS;
+
+      /***************
+       ** Variables **
+       ***************/
+      void enabled(const bool enabled) { _enabled = enabled; }
+      const inline bool enabled() const { return _enabled; }
+      void name(const std::string &);
+      const inline char *name() const { return _name; }
+      const inline size_t capacity() const { return _events.size(); }
+      const inline bool isRegistered() const { return _registered; }
+
+      void record(const flightEventEnum type, const uint32_t id, const uint32_t value,
+                  const uint16_t status, const char *token) {
+        FlightRecorder_Event *e;
+        uint64_t seq;
+
+        if (!_enabled)
+          return;
+
+        seq = __sync_fetch_and_add(&_next, 1);
+        e = &_events[seq & _mask];
+
+        e->seq = 0;
+        __sync_synchronize();
+        e->us = _now();
+        e->id = id;
+        e->value = value;
+        e->type = type;
+        e->status = status;
+        _copyToken(e->token, token);
+        __sync_synchronize();
+        e->seq = seq + 1;
+      } // record
+      void record(const flightEventEnum type, const uint32_t value) { record(type, 0, value, 0, NULL); }
+
+      // Oldest first; returns how many were copied.
+      const size_t snapshot(std::vector<FlightRecorder_Event> &) const;
+      const bool dump(const int) const;
+
+      static const bool dumpOnSignal(const int, const int);
+      static void dumpAll(const int);
+      static const unsigned int numUnregistered();
+      static const char *eventName(const unsigned int);
+
+    protected:
+    private:
+      static const uint64_t _now();
+      static void _copyToken(char *, const char *);
+      static void _signalHandler(int);
+
+      std::vector<FlightRecorder_Event> _events;	// power of two sized ring
+      uint64_t _mask;				// _events.size() - 1
+      uint64_t _next;				// position of the next event
+      bool _enabled;				// recording at all
+      bool _registered;				// has a slot dumpAll() walks
+      char _name[FLIGHT_NAME_SIZE];		// printed in dumps, host:port
+  }; // FlightRecorder
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
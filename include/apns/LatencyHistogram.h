@@ -0,0 +1,107 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_LATENCYHISTOGRAM_H
+#define LIBAPNS_LATENCYHISTOGRAM_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Log-linear histogram of microsecond latencies in the spirit of
+  // HdrHistogram: values below 64 get a bucket each, above that every
+  // power of two is split into 32 buckets, so any value is reported
+  // within about 3% using 1024 counters (8k) up to ~19 hours.  Recording
+  // is a bit scan and an increment.
+  //
+  // Not locked; read it on the thread that records into it, or copy it.
+  class LatencyHistogram {
+    public:
+      LatencyHistogram();
+      virtual ~LatencyHistogram();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const unsigned int SUB_BUCKET_BITS;
+      static const uint64_t MAXIMUM_VALUE;
+
+      /***************
+       ** Variables **
+       ***************/
+      // Monotonic clock in microseconds, for taking the timestamps.
+      static const uint64_t now();
+
+      void record(const uint64_t);
+      void recordSince(const uint64_t startUs) { record(now() - startUs); }
+      void merge(const LatencyHistogram &);
+      void reset();
+
+      const inline unsigned long long count() const { return _count; }
+      const inline uint64_t min() const { return _count ? _min : 0; }
+      const inline uint64_t max() const { return _max; }
+      const uint64_t mean() const;
+      // Smallest recorded bucket value at or below which the given
+      // percentage (0-100) of samples fall.
+      const uint64_t percentile(const double) const;
+      const inline uint64_t p50() const { return percentile(50.0); }
+      const inline uint64_t p99() const { return percentile(99.0); }
+      const inline uint64_t p999() const { return percentile(99.9); }
+
+      // "p50(..) p99(..) p999(..) max(..) count(..)", microseconds
+      const std::string summary() const;
+
+    protected:
+    private:
+      const size_t _index(const uint64_t) const;
+      const uint64_t _highestValue(const size_t) const;
+
+      std::vector<unsigned long long> _counts;	// samples per bucket
+      unsigned long long _count;			// samples recorded
+      uint64_t _sum;				// of all samples, for the mean
+      uint64_t _min;				// smallest sample
+      uint64_t _max;				// largest sample
+  }; // LatencyHistogram
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
@@ -0,0 +1,136 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_METRICSREGISTRY_H
+#define LIBAPNS_METRICSREGISTRY_H
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "ApnsAbstract.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+#define METRICS_MAXIMUM_STATUS		256
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  enum metricsQueueEnum {
+    METRICS_QUEUE_SEND		= 0,
+    METRICS_QUEUE_STAGE		= 1,
+    METRICS_QUEUE_ERROR		= 2,
+    METRICS_QUEUE_HELD		= 3,
+    METRICS_QUEUE_MAX		= 4
+  };
+
+  // One controller's counters and gauges.  The owner updates them with
+  // the helpers below, never a lock; anyone else reads them through
+  // MetricsRegistry::snapshot(), which copies them out field by field.
+  typedef struct {
+    unsigned long long framesWritten;		// frames completely written
+    unsigned long long bytesWritten;		// bytes SSL_write accepted
+    unsigned long long connects;		// connections established
+    unsigned long long connectFailures;		// connect attempts given up on
+    unsigned long long disconnects;		// connections dropped for cause
+    unsigned long long deadTokens;		// messages refused for dead tokens
+    unsigned long long rateLimited;		// messages dropped, held or collapsed
+    unsigned long long errors[METRICS_MAXIMUM_STATUS];	// error responses by status
+    unsigned long long queueDepth[METRICS_QUEUE_MAX];	// messages per queue
+    unsigned long long queueOldestUs[METRICS_QUEUE_MAX];	// age of the oldest, microseconds
+  } PushMetrics_t;
+
+  class MetricsRegistry_Exception : public ApnsAbstract_Exception {
+    public:
+      MetricsRegistry_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class MetricsRegistry_Exception
+
+  // Names the metrics blocks of any number of controllers and exports
+  // them in the Prometheus text format, to a file (for a textfile
+  // collector) or to whoever connects to a local socket.  Blocks are not
+  // owned; PushController::metricsRegistry() adds and removes its own.
+  class MetricsRegistry : public ApnsAbstract {
+    public:
+      MetricsRegistry();
+      virtual ~MetricsRegistry();
+
+      typedef std::map<std::string, PushMetrics_t *> metricsMapType;
+      typedef std::pair<std::string, PushMetrics_t> snapshotPairType;
+      typedef std::vector<snapshotPairType> snapshotVectorType;
+
+      /***************
+       ** Variables **
+       ***************/
+      static void increment(unsigned long long &counter, const unsigned long long n) { __sync_fetch_and_add(&counter, n); }
+      static void set(unsigned long long &gauge, const unsigned long long value) { __sync_lock_test_and_set(&gauge, value); }
+      static const unsigned long long get(const unsigned long long &value) {
+        return __sync_fetch_and_add(const_cast<unsigned long long *>(&value), 0);
+      } // get
+      static void copy(PushMetrics_t &, const PushMetrics_t &);
+
+      void add(const std::string &, PushMetrics_t *);
+      void remove(const PushMetrics_t *);
+      const size_t size();
+
+      const size_t snapshot(snapshotVectorType &);
+      const std::string prometheus();
+      const bool writeFile(const std::string &);
+
+      // Unix socket that answers every connection with the current
+      // exposition and closes it; serve() handles whoever is waiting.
+      const bool listen(const std::string &);
+      const unsigned int serve(const int);
+      const inline int fd() const { return _listenFd; }
+
+    protected:
+    private:
+      static const std::string _escape(const std::string &);
+      static void _counter(std::stringstream &, const char *, const char *,
+                           const snapshotVectorType &, unsigned long long PushMetrics_t::*);
+
+      pthread_mutex_t _mutex;			// guards _metrics
+      metricsMapType _metrics;			// registered blocks by name
+      std::string _listenPath;			// socket path we listen on
+      int _listenFd;				// listening socket or -1
+  }; // MetricsRegistry
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
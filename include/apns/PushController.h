@@ -26,7 +26,11 @@
 #ifndef LIBAPNS_PUSHCONTROLLER_H
 #define LIBAPNS_PUSHCONTROLLER_H
 
+#include <deque>
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include <netdb.h>
 #include <unistd.h>
@@ -41,6 +45,7 @@
 #include <openssl/err.h>
 
 #include "ApnsAbstract.h"
+#include "MetricsRegistry.h"
 #include "SslController.h"
 
 namespace apns {
@@ -50,7 +55,7 @@ namespace apns {
  **************************************************************************/
 
 #define DEVICE_BINARY_SIZE  32
-#define MAXPAYLOAD_SIZE     256
+#define MAXPAYLOAD_SIZE     256		// legacy packet struct size, see maxPayloadSize()
 
 /**************************************************************************
  ** Structures                                                           **
@@ -93,6 +98,36 @@ typedef struct {
   } ApnsResponse_t;
 
   class ApnsMessage;
+  class DeadTokenFilter;
+  class TokenRateLimiter;
+
+  enum pushOutcomeEnum {
+    OUTCOME_SENT		= 0,		// written and not rejected within the response window
+    OUTCOME_FAILED		= 1,		// rejected by APNs, see status
+    OUTCOME_EXPIRED		= 2,		// expired before it could be written
+    OUTCOME_RETRIES_EXHAUSTED	= 3,		// lost with its connection more than maxRetries times
+    OUTCOME_DROPPED		= 4		// refused or discarded by a limit, or on shutdown
+  };
+
+  typedef struct {
+    std::string customIdentifier;
+    std::string deviceToken;
+    unsigned int id;				// frame identifier it last went out with
+    pushOutcomeEnum outcome;
+    int status;					// APNs status for failures, ERR_INVALID_TOKEN
+						// for messages dropped as dead, otherwise 0
+    time_t ts;					// when the outcome was decided
+  } PushOutcome;
+
+  // Receives what became of messages the controller owned, one batch per
+  // run(), drain() and on destruction; the array is only valid during the
+  // call.  The handler must outlive the controller.
+  class PushOutcomeHandler {
+    public:
+      virtual ~PushOutcomeHandler() { }
+
+      virtual void onOutcomes(const PushOutcome *, const size_t) = 0;
+  }; // PushOutcomeHandler
 
   class PushController_Exception : public ApnsAbstract_Exception {
     public:
@@ -105,14 +140,31 @@ typedef struct {
       virtual ~PushController();
 
       typedef std::set<ApnsMessage *> messageQueueType;
+      typedef std::pair<unsigned long long, ApnsMessage *> pendingFramePairType;
+      typedef std::deque<pendingFramePairType> pendingFrameQueueType;
+      typedef std::pair<time_t, ApnsMessage *> inflightFramePairType;
+      typedef std::deque<inflightFramePairType> inflightFrameQueueType;
+      typedef std::multimap<std::string, ApnsMessage *> heldMessageMapType;
 
       /**********************
        ** Type Definitions **
        **********************/
       static const time_t DEFAULT_STATS_INTERVAL;
       static const time_t CONNECT_RETRY_TIMEOUT;
+      static const time_t CONNECT_RETRY_MINIMUM;
       static const int ERROR_RESPONSE_SIZE;
       static const int ERROR_RESPONSE_COMMAND;
+      static const size_t DEFAULT_MAXIMUM_PAYLOAD_SIZE;
+      static const size_t PROTOCOL_MAXIMUM_PAYLOAD_SIZE;
+      static const size_t DEFAULT_WRITE_BUFFER_SIZE;
+      static const size_t MINIMUM_BATCH_SIZE;
+      static const time_t DEFAULT_DEAD_PEER_TIMEOUT;
+      static const time_t RESPONSE_WINDOW;
+      static const time_t DEFAULT_DRAIN_TIMEOUT;
+      static const time_t DEFAULT_DRAIN_LINGER;
+      static const int DRAIN_POLL_INTERVAL;
+      static const unsigned int DEFAULT_LOG_SAMPLE_RATE;
+      static const size_t DEFAULT_MAXIMUM_HELD;
 
       enum pushCommandsEnum {
         COMMAND_PUSH_SIMPLE	= 0,
@@ -132,23 +184,92 @@ typedef struct {
         ERR_NONE_UNKNOWN		= 255
       };
 
+      // What add() does with a message over its token's rate limit.
+      enum overLimitPolicyEnum {
+        OVERLIMIT_DROP		= 0,		// refuse it, the caller keeps it
+        OVERLIMIT_DELAY		= 1,		// hold it until the token is under the limit
+        OVERLIMIT_COLLAPSE	= 2		// as delay, but only the newest held one is kept
+      };
+
       /***************
        ** Variables **
        ***************/
       void timeout(const time_t timeout) { _timeout = timeout; }
       const inline time_t timeout() { return _timeout; }
+      // Failed connects back off exponentially from the minimum up to
+      // the retry timeout, with jitter.
       void connectRetrytimeout(const time_t connectRetryTimeout) { _connectRetryTimeout = connectRetryTimeout; }
       const inline time_t connectRetrytimeout() { return _connectRetryTimeout; }
+      void connectRetryMinimum(const time_t connectRetryMinimum) { _connectRetryMinimum = connectRetryMinimum; }
+      const inline time_t connectRetryMinimum() const { return _connectRetryMinimum; }
+      void maxPayloadSize(const size_t maxPayloadSize) {
+        if (!maxPayloadSize || maxPayloadSize > PROTOCOL_MAXIMUM_PAYLOAD_SIZE)
+          throw PushController_Exception("Invalid maximum payload size.");
+        _maxPayloadSize = maxPayloadSize;
+      } // maxPayloadSize
+      const inline size_t maxPayloadSize() const { return _maxPayloadSize; }
+      void writeBufferSize(const size_t writeBufferSize) { _writeBufferSize = writeBufferSize; }
+      const inline size_t writeBufferSize() const { return _writeBufferSize; }
+      void adaptiveBatching(const bool adaptiveBatching) { _adaptiveBatching = adaptiveBatching; }
+      const inline bool adaptiveBatching() const { return _adaptiveBatching; }
+      const inline size_t batchBytes() const { return _batchBytes; }
+      void deadPeerTimeout(const time_t deadPeerTimeout) { _deadPeerTimeout = deadPeerTimeout; }
+      const inline time_t deadPeerTimeout() const { return _deadPeerTimeout; }
+      void drainTimeout(const time_t drainTimeout) { _drainTimeout = drainTimeout; }
+      const inline time_t drainTimeout() const { return _drainTimeout; }
+      void drainLinger(const time_t drainLinger) { _drainLinger = drainLinger; }
+      const inline time_t drainLinger() const { return _drainLinger; }
 
-      void add(ApnsMessage *);
+      // Takes ownership and returns true, or returns false and leaves the
+      // message with the caller when:
+      //   - draining, until resume();
+      //   - its token is in deadTokenFilter(), reported OUTCOME_DROPPED;
+      //   - it is over rateLimiter() under OVERLIMIT_DROP, or would grow a
+      //     hold queue already at maximumHeld(), reported OUTCOME_DROPPED.
+      const bool add(ApnsMessage *);
       const bool remove(ApnsMessage *);
-      void Push(ApnsMessage *aMessage) { add(aMessage); }
+      const bool Push(ApnsMessage *aMessage) { return add(aMessage); }
+      const unsigned int drain(const time_t, messageQueueType &);
+      const inline bool isDraining() const { return _draining; }
+      void resume() { _draining = false; }
+      // add() refuses messages for tokens in the filter and tokens APNs
+      // rejects as invalid are added to it; not owned.
+      void deadTokenFilter(DeadTokenFilter *deadTokenFilter) { _deadTokenFilter = deadTokenFilter; }
+      DeadTokenFilter *deadTokenFilter() const { return _deadTokenFilter; }
+      // Caps how often add() accepts messages for one token; not owned.
+      void rateLimiter(TokenRateLimiter *rateLimiter) { _rateLimiter = rateLimiter; }
+      TokenRateLimiter *rateLimiter() const { return _rateLimiter; }
+      void overLimitPolicy(const overLimitPolicyEnum overLimitPolicy) { _overLimitPolicy = overLimitPolicy; }
+      const inline overLimitPolicyEnum overLimitPolicy() const { return _overLimitPolicy; }
+      const heldMessageMapType::size_type heldQueueSize() const { return _heldMessages.size(); }
+      // Once this many are held, messages that would add to them are
+      // refused as under OVERLIMIT_DROP.
+      void maximumHeld(const size_t maximumHeld) { _maximumHeld = maximumHeld; }
+      const inline size_t maximumHeld() const { return _maximumHeld; }
+      const inline unsigned long long numRateDropped() const { return _numRateDropped; }
+      const inline unsigned long long numRateDelayed() const { return _numRateDelayed; }
+      const inline unsigned long long numRateCollapsed() const { return _numRateCollapsed; }
+      // add() until the frame is fully written, and written until the
+      // peer has acked it (the closest the protocol gets to delivered)
+      const inline LatencyHistogram &queueLatency() const { return _queueLatency; }
+      const inline LatencyHistogram &confirmLatency() const { return _confirmLatency; }
+      // Counters and queue gauges, safe to read from another thread via
+      // MetricsRegistry::copy(); registering names them for export.
+      const inline PushMetrics_t &metrics() const { return _metrics; }
+      void metricsRegistry(MetricsRegistry *, const std::string &);
+      MetricsRegistry *metricsRegistry() const { return _metricsRegistry; }
+      void outcomeHandler(PushOutcomeHandler *outcomeHandler) { _outcomeHandler = outcomeHandler; }
+      PushOutcomeHandler *outcomeHandler() const { return _outcomeHandler; }
       const bool run();
       void logStatsInterval(const time_t logStatsInterval) {
         _logStatsInterval = logStatsInterval;
         _logStatsTs = time(NULL) + _logStatsInterval;
       } // logStatsInterval
       const inline time_t logStatsInterval() { return _logStatsInterval; }
+      // Only one message in this many gets its per message log lines,
+      // 1 logs them all.
+      void logSampleRate(const unsigned int logSampleRate) { _logSampleRate = logSampleRate; }
+      const inline unsigned int logSampleRate() const { return _logSampleRate; }
       const messageQueueType::size_type sendQueueSize() const { return _messageSendQueue.size(); }
 
     protected:
@@ -159,7 +280,28 @@ typedef struct {
       void _add(ApnsMessage *);
       const bool _remove(ApnsMessage *);
       void _processMessageSendQueue();
+      void _scheduleReconnect();
+      const size_t _batchBudget();
+      void _completeWrittenFrames();
+      const unsigned int _requeueUnwrittenFrames(const bool);
+      const unsigned int _requeueInflightFrames();
+      void _checkPeerLiveness();
+      void _pruneInflightFrames();
+      void _noteAcks();
+      void _forgetFrames(const messageQueueType &);
+      const unsigned int _requeueFramesAfter(ApnsMessage *);
+      const bool _lingerForResponses(const time_t);
+      void _drainConnection(const time_t);
+      const bool _overLimit(ApnsMessage *);
+      void _releaseHeldMessages();
+      const unsigned int _clearHeldMessages(messageQueueType &);
+      void _updateQueueGauges();
+      void _noteOutcome(ApnsMessage *, const pushOutcomeEnum, const int);
+      void _recordOutcome(const ApnsMessage *, const pushOutcomeEnum, const int);
+      void _deliverOutcomes();
+      const uint64_t _oldestQueued(const messageQueueType &, const uint64_t);
       void _expireIdleConnection();
+      void _closeIdleConnection();
       const int _readResponseFromApns();
       void _processResponseFromApns(const ApnsResponse_t *);
       void _removeMessageFromQueueById(const unsigned int, const bool);
@@ -169,21 +311,59 @@ typedef struct {
       const unsigned int _removeExpiredMessagesFromQueue(messageQueueType &);
       const unsigned int _clearMessagesFromQueue(messageQueueType &);
       void _logStats();
+      const bool _sampleMessageLog();
       ApnsMessage *_findById(const unsigned int);
 
       messageQueueType _messageSendQueue;		// storage for messages to deliver
       messageQueueType _messageStageQueue;	// storage for messages that are in progress
       messageQueueType _messageErrorQueue;	// storage for messages with errors
+      pendingFrameQueueType _pendingFrames;	// buffered frames by end offset, oldest first
+      unsigned long long _writtenFramesEnd;	// where the last frame written in full ends
+      inflightFrameQueueType _inflightFrames;	// written frames APNs may still reject, oldest first
       time_t _timeout;				// timeout in seconds to close connection
       time_t _logStatsInterval;			// interval to log statistics
-      time_t _connectRetryTimeout;		// retry timeout for connecting
+      time_t _connectRetryTimeout;		// longest we back off between connect attempts
+      time_t _connectRetryMinimum;		// first back off after a failed connect
+      unsigned int _connectFailures;		// connect attempts failed in a row
       time_t _lastActivityTs;			// last activity ts
       time_t _connectRetryTs;			// next time to try reconnecting after error
       time_t _logStatsTs;				// logstats timer
+      size_t _maxPayloadSize;			// largest payload we will send
+      size_t _writeBufferSize;			// stop framing once this much is unflushed
+      size_t _batchBytes;			// bytes we aimed to have in flight last batch
+      bool _adaptiveBatching;			// size batches from the kernel's view
+      time_t _deadPeerTimeout;			// seconds unacked data may sit before we give up
+      time_t _livenessCheckTs;			// last time we checked for a dead peer
+      time_t _lastAckTs;				// when the peer last acked, as of our last sample
+      size_t _ackedFrames;			// leading in-flight frames known to be acked
+      time_t _drainTimeout;			// seconds the destructor may spend draining
+      time_t _drainLinger;			// seconds to wait for error responses once drained or idle
+      time_t _closingTs;				// idle connection closes at, 0 if not closing
+      bool _draining;				// refusing new messages while draining
+      DeadTokenFilter *_deadTokenFilter;		// tokens we know are gone, may be NULL
+      TokenRateLimiter *_rateLimiter;		// per token send limit, may be NULL
+      overLimitPolicyEnum _overLimitPolicy;	// what to do with messages over the limit
+      heldMessageMapType _heldMessages;		// messages over the limit by token, oldest first
+      size_t _maximumHeld;			// cap on _heldMessages
+      time_t _releaseHeldTs;			// last time we offered held messages to the limiter
+      unsigned long long _numRateDropped;		// messages refused over the limit
+      unsigned long long _numRateDelayed;		// messages held over the limit
+      unsigned long long _numRateCollapsed;	// held messages replaced by a newer one
+      LatencyHistogram _queueLatency;		// add() to written
+      LatencyHistogram _confirmLatency;		// written to acked
+      PushMetrics_t _metrics;			// updated lock free, read from anywhere
+      MetricsRegistry *_metricsRegistry;		// we are registered with, may be NULL
+      time_t _queueAgeTs;				// last time the oldest ages were taken
+      PushOutcomeHandler *_outcomeHandler;	// if set, gets _outcomes every run
+      std::vector<PushOutcome> _outcomes;		// decided since the last delivery
+      unsigned int _logSampleRate;		// log one message in this many
+      unsigned int _logSampleCount;		// messages seen for sampling
       unsigned int _lastId;			// last message id in use
       unsigned int _numStatsSent;			// number of messages sent
       unsigned int _numStatsError;		// number of messages that received errors
       unsigned int _numStatsDisconnected;		// number of times disconnected
+      unsigned int _numStatsDeadTokens;		// number of messages refused for dead tokens
+      unsigned int _numStatsRateLimited;		// number of messages dropped, held or collapsed
   }; // PushController
 
 /**************************************************************************
@@ -0,0 +1,127 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_PUSHDISPATCHER_H
+#define LIBAPNS_PUSHDISPATCHER_H
+
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include "ApnsAbstract.h"
+#include "ApnsMessage.h"
+#include "PushController.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  typedef struct {
+    std::string host;				// gateway for this environment
+    int port;
+    size_t maxConnections;			// most controllers we will open
+    std::vector<PushController *> controllers;	// first one is never retired
+  } PushDispatcher_Pool;
+
+  class PushDispatcher_Exception : public ApnsAbstract_Exception {
+    public:
+      PushDispatcher_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class PushDispatcher_Exception
+
+  // Routes each message to the sandbox or production gateway by its
+  // environment().  Every environment has its own pool of controllers
+  // that grows while its queues are deep and shrinks back once the extra
+  // connections go idle, so a slow or unreachable sandbox never holds up
+  // production.
+  class PushDispatcher : public ApnsAbstract {
+    public:
+      PushDispatcher(const std::string &, const std::string &, const std::string &, const time_t);
+      virtual ~PushDispatcher();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const char *SANDBOX_HOST;
+      static const char *PRODUCTION_HOST;
+      static const int GATEWAY_PORT;
+      static const size_t DEFAULT_MAXIMUM_CONNECTIONS;
+      static const size_t DEFAULT_MESSAGES_PER_CONNECTION;
+
+      typedef PushController::messageQueueType messageQueueType;
+
+      /***************
+       ** Variables **
+       ***************/
+      void gateway(const ApnsMessage::apnsEnvironmentEnum, const std::string &, const int);
+      void maxConnections(const ApnsMessage::apnsEnvironmentEnum, const size_t);
+      const size_t maxConnections(const ApnsMessage::apnsEnvironmentEnum) const;
+      void messagesPerConnection(const size_t messagesPerConnection) { _messagesPerConnection = messagesPerConnection; }
+      const inline size_t messagesPerConnection() const { return _messagesPerConnection; }
+      const size_t numConnections(const ApnsMessage::apnsEnvironmentEnum) const;
+      const size_t sendQueueSize(const ApnsMessage::apnsEnvironmentEnum) const;
+
+      // Returns false without taking ownership while draining or when
+      // the chosen controller refuses it, see PushController::add().
+      const bool add(ApnsMessage *);
+      const bool Push(ApnsMessage *aMessage) { return add(aMessage); }
+      const bool run();
+      const unsigned int drain(const time_t, messageQueueType &);
+
+    protected:
+      // Override to apply socket options, payload limits and the like
+      // to each controller as the pools grow.
+      virtual PushController *_createController(const PushDispatcher_Pool &);
+
+    private:
+      const PushDispatcher_Pool &_pool(const ApnsMessage::apnsEnvironmentEnum) const;
+      PushDispatcher_Pool &_pool(const ApnsMessage::apnsEnvironmentEnum);
+      PushController *_route(PushDispatcher_Pool &);
+      void _shrink(PushDispatcher_Pool &);
+
+      PushDispatcher_Pool _pools[2];		// indexed by apnsEnvironmentEnum
+      std::string _certfile;			// client certificate for every controller
+      std::string _keyfile;
+      std::string _capath;
+      time_t _timeout;				// idle timeout handed to controllers
+      size_t _messagesPerConnection;		// queue depth before opening another
+      bool _draining;				// refusing new messages
+  }; // PushDispatcher
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
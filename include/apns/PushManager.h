@@ -0,0 +1,141 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_PUSHMANAGER_H
+#define LIBAPNS_PUSHMANAGER_H
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <time.h>
+
+#include "ApnsAbstract.h"
+#include "ApnsMessage.h"
+#include "PushController.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  typedef struct {
+    std::string name;				// topic, also the key we are found by
+    std::string host;
+    int port;
+    std::string certfile;
+    std::string keyfile;
+    std::string capath;
+    unsigned int weight;			// share of each scheduling round
+    size_t deficit;				// messages owed from earlier rounds
+    std::deque<ApnsMessage *> queue;		// waiting for the scheduler, oldest first
+    PushController *controller;			// only while the tenant has traffic
+  } PushManager_Tenant;
+
+  class PushManager_Exception : public ApnsAbstract_Exception {
+    public:
+      PushManager_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class PushManager_Exception
+
+  // Hosts many tenants, each with its own certificate, on one thread.
+  // A tenant costs a queue and a few strings until it has traffic; its
+  // PushController is created on the first message and thrown away once
+  // idle expiry has closed it and nothing is left to send.  run() feeds
+  // the controllers by deficit round robin, weight() messages per quantum
+  // per round, and then waits on all of their sockets at once.
+  //
+  // add() takes ownership unless it returns false.  A message its
+  // tenant's controller later refuses (dead token, over the rate limit)
+  // is reported OUTCOME_DROPPED through that controller's outcome handler
+  // and deleted; drain() and removeTenant() hand back the rest.
+  class PushManager : public ApnsAbstract {
+    public:
+      PushManager(const time_t);
+      virtual ~PushManager();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const size_t DEFAULT_QUANTUM;
+      static const size_t DEFAULT_WINDOW;
+      static const int DEFAULT_RUN_TIMEOUT;
+      static const int CONNECTING_POLL_INTERVAL;
+
+      typedef PushController::messageQueueType messageQueueType;
+      typedef std::map<std::string, PushManager_Tenant *> tenantMapType;
+
+      /***************
+       ** Variables **
+       ***************/
+      void quantum(const size_t quantum) { _quantum = quantum; }
+      const inline size_t quantum() const { return _quantum; }
+      void window(const size_t window) { _window = window; }
+      const inline size_t window() const { return _window; }
+
+      void addTenant(const std::string &, const std::string &, const int, const std::string &, const std::string &, const std::string &, const unsigned int);
+      const unsigned int removeTenant(const std::string &, messageQueueType &);
+      void weight(const std::string &, const unsigned int);
+      const bool isTenant(const std::string &name) const { return _tenants.find(name) != _tenants.end(); }
+      const size_t numTenants() const { return _tenants.size(); }
+      const size_t numActive() const;
+      const size_t queueSize(const std::string &) const;
+
+      const bool add(const std::string &, ApnsMessage *);
+      const bool run() { return run(DEFAULT_RUN_TIMEOUT); }
+      const bool run(const int);
+      const unsigned int drain(const time_t, messageQueueType &);
+
+    protected:
+      // Override to configure each tenant's controller as it is opened.
+      virtual PushController *_createController(const PushManager_Tenant &);
+
+    private:
+      PushManager_Tenant *_find(const std::string &) const;
+      const bool _schedule();
+      void _schedule(PushManager_Tenant *);
+      const int _wait(const int, const bool);
+      void _retire(PushManager_Tenant *);
+
+      tenantMapType _tenants;			// every tenant by name
+      time_t _timeout;				// idle timeout handed to controllers
+      size_t _quantum;				// messages per weight per round
+      size_t _window;				// most messages a controller holds unsent
+      bool _draining;				// refusing new messages
+  }; // PushManager
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
@@ -0,0 +1,100 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_RESOLVER_H
+#define LIBAPNS_RESOLVER_H
+
+#include <string>
+
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  // Everything glibc's resolver thread touches lives in one heap block
+  // so it can outlive the Resolver if the lookup can't be cancelled.
+  typedef struct {
+    struct gaicb cb;
+    struct addrinfo hints;
+    char name[NI_MAXHOST];
+    char service[NI_MAXSERV];
+  } Resolver_Request;
+
+  // A single asynchronous hostname lookup (getaddrinfo_a), polled
+  // from the caller's loop instead of blocking it.
+  class Resolver {
+    public:
+      Resolver(const std::string &, const int);
+      virtual ~Resolver();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      enum resolveStatusEnum {
+        RESOLVE_INPROGRESS	= 0,
+        RESOLVE_DONE		= 1,
+        RESOLVE_FAILED		= 2
+      };
+
+      /***************
+       ** Variables **
+       ***************/
+      const inline std::string &host() const { return _host; }
+      const inline int port() const { return _port; }
+      const inline std::string &error() const { return _error; }
+
+      const resolveStatusEnum poll();
+      const struct addrinfo *result() const;
+
+    protected:
+    private:
+      static void _release(Resolver_Request *);
+      static void _reap();
+
+      std::string _host;
+      int _port;
+      std::string _error;
+      resolveStatusEnum _status;
+      Resolver_Request *_request;
+  }; // Resolver
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
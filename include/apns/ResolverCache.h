@@ -0,0 +1,110 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_RESOLVERCACHE_H
+#define LIBAPNS_RESOLVERCACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  typedef struct {
+    struct sockaddr_storage addr;	// gateway address
+    socklen_t addrlen;			// length of addr
+    time_t penaltyTs;			// skipped until this time after failing
+    unsigned int failures;		// consecutive connect/handshake failures
+  } ResolverCache_Address;
+
+  typedef struct {
+    std::vector<ResolverCache_Address> addresses;
+    time_t expireTs;			// addresses are re-resolved after this
+    size_t next;			// round robin cursor
+  } ResolverCache_Entry;
+
+  // Process wide cache of every A/AAAA address a gateway resolves to.
+  // New connections are spread round robin across the addresses and an
+  // address that fails to connect or handshake is skipped for a while,
+  // backing off exponentially, so callers fall over to the next one.
+  //
+  // getaddrinfo() doesn't expose record TTLs, so entries live for a
+  // configurable ttl() instead; a stale entry is still used if the
+  // refreshing lookup fails.
+  class ResolverCache {
+    public:
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const time_t DEFAULT_TTL;
+      static const time_t PENALTY_MINIMUM;
+      static const time_t PENALTY_MAXIMUM;
+
+      typedef std::map<std::string, ResolverCache_Entry> entryMapType;
+
+      /***************
+       ** Variables **
+       ***************/
+      static void ttl(const time_t);
+      static const time_t ttl();
+
+      static const bool isFresh(const std::string &, const int);
+      static const size_t size(const std::string &, const int);
+      static const size_t store(const std::string &, const int, const struct addrinfo *);
+      static const bool pick(const std::string &, const int, struct sockaddr_storage &, socklen_t &);
+      static void failed(const std::string &, const int, const struct sockaddr_storage &, const socklen_t);
+      static void succeeded(const std::string &, const int, const struct sockaddr_storage &, const socklen_t);
+      static const unsigned int clear();
+
+      static const std::string addressString(const struct sockaddr_storage &, const socklen_t);
+
+    protected:
+    private:
+      static ResolverCache_Address *_find(ResolverCache_Entry &, const struct sockaddr_storage &, const socklen_t);
+      static const std::string _key(const std::string &, const int);
+  }; // ResolverCache
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
@@ -0,0 +1,97 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_SSLCONTEXTCACHE_H
+#define LIBAPNS_SSLCONTEXTCACHE_H
+
+#include <map>
+#include <string>
+
+#include <time.h>
+#include <sys/types.h>
+
+#include <openssl/crypto.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "ApnsAbstract.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  typedef struct {
+    SSL_CTX *ctx;			// context handed out to connections
+    unsigned int generation;		// bumped every time ctx is rebuilt
+    time_t nextCheckTs;			// next time we stat the pem files
+    time_t certMtime;			// certificate modification time
+    time_t keyMtime;			// private key modification time
+    ino_t certIno;			// certificate inode, catches renames
+    ino_t keyIno;			// private key inode, catches renames
+  } SslContextCache_Entry;
+
+  // Process wide cache of client SSL_CTX's keyed by (cert, key, CA path)
+  // shared by every PushController and FeedbackController.  A context is
+  // built once and handed out with an extra reference; when the pem files
+  // change on disk a replacement is built and swapped in, connections
+  // already holding the old one keep it until they disconnect.
+  class SslContextCache {
+    public:
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const time_t RELOAD_CHECK_INTERVAL;
+
+      typedef std::map<std::string, SslContextCache_Entry> contextMapType;
+
+      /***************
+       ** Variables **
+       ***************/
+      static SSL_CTX *get(const std::string &, const std::string &, const std::string &, unsigned int &, std::string &);
+      static const bool preload(const std::string &, const std::string &, const std::string &, std::string &);
+      static const unsigned int clear();
+
+    protected:
+    private:
+      static SSL_CTX *_build(const std::string &, const std::string &, const std::string &, std::string &);
+      static const bool _stat(const std::string &, time_t &, ino_t &);
+      static const std::string _key(const std::string &, const std::string &, const std::string &);
+  }; // SslContextCache
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
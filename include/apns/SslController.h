@@ -39,6 +39,9 @@
 #include <openssl/err.h>
 
 #include "ApnsAbstract.h"
+#include "FlightRecorder.h"
+#include "LatencyHistogram.h"
+#include "Resolver.h"
 
 namespace apns {
 
@@ -60,19 +63,67 @@ namespace apns {
       BIO             *sbio;
 
       /* Socket Communications */
-      struct sockaddr_in   server_addr;
-      struct hostent      *host_info;
+      struct sockaddr_storage server_addr;
+      socklen_t            server_addr_len;
+      Resolver            *resolver;
+      size_t               attempts;	/* addresses tried this connect */
       int                  sock;
   } SSL_Connection;
 
+  // Socket tuning applied to every connection a controller makes; zero
+  // leaves the kernel default in place.
+  struct SocketOptions {
+    SocketOptions() : noDelay(false), cork(false), sendBufferSize(0),
+      receiveBufferSize(0), keepAlive(false), keepAliveIdle(0),
+      keepAliveInterval(0), keepAliveCount(0), userTimeout(0) { }
+
+    bool noDelay;			// TCP_NODELAY, for latency sensitive lanes
+    bool cork;				// TCP_CORK around each flushed batch
+    int sendBufferSize;			// SO_SNDBUF in bytes
+    int receiveBufferSize;		// SO_RCVBUF in bytes
+    bool keepAlive;			// SO_KEEPALIVE
+    int keepAliveIdle;			// TCP_KEEPIDLE seconds before first probe
+    int keepAliveInterval;		// TCP_KEEPINTVL seconds between probes
+    int keepAliveCount;			// TCP_KEEPCNT probes before giving up
+    int userTimeout;			// TCP_USER_TIMEOUT ms data may go unacked
+  }; // SocketOptions
+
+  // What the kernel says about a connection, see sampleSocket().
+  typedef struct {
+    time_t ts;				// when this was sampled
+    int sendQueue;			// SIOCOUTQ, bytes sent but unacked plus unsent
+    int unsent;				// SIOCOUTQNSD, bytes not yet sent
+    unsigned int rtt;			// smoothed round trip in microseconds
+    unsigned int rttVar;		// round trip variance in microseconds
+    unsigned int cwnd;			// congestion window in segments
+    unsigned int mss;			// send maximum segment size
+    unsigned int unacked;		// segments in flight
+    unsigned int retransmits;		// segments retransmitted over the connection
+    unsigned int lastAckRecv;		// milliseconds since the peer last acked
+  } SocketSample;
+
   class SslController : public ApnsAbstract {
     public:
       SslController(const std::string &, const int, const std::string &, const std::string &, const std::string &);
       virtual ~SslController();
 
+      friend class SslContextCache;
+
       /**********************
        ** Type Definitions **
        **********************/
+      static const time_t DEFAULT_RESOLVE_TIMEOUT;
+      static const time_t DEFAULT_CONNECT_TIMEOUT;
+      static const time_t DEFAULT_HANDSHAKE_TIMEOUT;
+      static const int DEFAULT_READ_TIMEOUT;
+
+      enum connectStateEnum {
+        STATE_DISCONNECTED	= 0,
+        STATE_RESOLVING		= 1,
+        STATE_CONNECTING	= 2,
+        STATE_HANDSHAKING	= 3,
+        STATE_CONNECTED		= 4
+      };
 
       /***************
        ** Variables **
@@ -84,19 +135,85 @@ namespace apns {
       const inline std::string &keyfile() const { return _keyfile; }
       const inline std::string &capath() const { return _capath; }
 
+      void sessionResumption(const bool sessionResumption) { _sessionResumption = sessionResumption; }
+      const inline bool sessionResumption() const { return _sessionResumption; }
+      const inline unsigned int sessionHits() const { return _sessionHits; }
+      const inline unsigned int sessionMisses() const { return _sessionMisses; }
+
+      void resolveTimeout(const time_t resolveTimeout) { _resolveTimeout = resolveTimeout; }
+      const inline time_t resolveTimeout() const { return _resolveTimeout; }
+      void connectTimeout(const time_t connectTimeout) { _connectTimeout = connectTimeout; }
+      const inline time_t connectTimeout() const { return _connectTimeout; }
+      void handshakeTimeout(const time_t handshakeTimeout) { _handshakeTimeout = handshakeTimeout; }
+      const inline time_t handshakeTimeout() const { return _handshakeTimeout; }
+      // milliseconds read() waits for data, 0 to only take what is there
+      void readTimeout(const int readTimeout) { _readTimeout = readTimeout; }
+      const inline int readTimeout() const { return _readTimeout; }
+
+      // Kernel TLS (Linux); falls back to userspace SSL_write when the
+      // kernel, OpenSSL build or negotiated cipher can't do it.
+      void kernelTls(const bool kernelTls) { _kernelTls = kernelTls; }
+      const inline bool kernelTls() const { return _kernelTls; }
+      const inline bool isKernelTlsSend() const { return _ktlsSend; }
+      const inline bool isKernelTlsRecv() const { return _ktlsRecv; }
+
+      void socketOptions(const SocketOptions &socketOptions) { _socketOptions = socketOptions; }
+      const inline SocketOptions &socketOptions() const { return _socketOptions; }
+
+      const bool sampleSocket();
+      const inline SocketSample &socketSample() const { return _socketSample; }
+
+      // tcp connect and tls handshake of each connection that made it
+      const inline LatencyHistogram &connectLatency() const { return _connectLatency; }
+      const inline LatencyHistogram &handshakeLatency() const { return _handshakeLatency; }
+
+      // recent connection events, PushController adds its frames
+      inline FlightRecorder &flightRecorder() { return _flightRecorder; }
+
+      const inline connectStateEnum connectState() const { return _state; }
+      const inline bool isConnecting() const { return _state != STATE_DISCONNECTED && _state != STATE_CONNECTED; }
+      const inline int fd() const { return _sslcon != NULL ? _sslcon->sock : -1; }
+      const short pollEvents() const;
+      const int waitForSocket(const int);
+
       const bool isConnected() { return _connected; }
+      // Never blocks; each call advances connection setup as far as it
+      // can and returns true once the handshake has completed.
       const bool connect() { return _connect(); }
       const bool disconnect() { return _disconnect(); }
       const int write(const char *, size_t);
       const int read(void *, size_t);
 
+      // Userspace output buffer; bufferWrite() queues, flush() pushes as
+      // much as the socket takes and is resumed when it is writable again.
+      // When a flush fails on a peer that hung up, what it sent first can
+      // still be read() until the next connect.
+      const bool bufferWrite(const char *, const size_t);
+      const int flush();
+      const inline size_t pendingBytes() const { return _outBuffer.length() - _outOffset; }
+      const inline unsigned long long bytesQueued() const { return _bytesQueued; }
+      const inline unsigned long long bytesFlushed() const { return _bytesFlushed; }
+
     protected:
     private:
       const bool _connect();
+      const bool _startResolve();
+      const bool _startConnect();
+      const bool _startHandshake();
+      const bool _tryNextAddress(const std::string &);
+      const bool _connectFailed(const std::string &);
+      const bool _phaseExpired(const time_t);
+      void _applySocketOptions();
+      void _setSocketOption(const int, const int, const int, const char *);
       const bool _disconnect();
+      void _salvageRead();
       const bool _checkCert();
       void _initialize();
       void _deinitialize();
+      void _storeSession(SSL_SESSION *);
+      void _clearSession();
+
+      static int _newSessionCallback(SSL *, SSL_SESSION *);
 
       // *** Variables ***
       bool _initialized;
@@ -106,6 +223,32 @@ namespace apns {
       std::string _certfile;
       std::string _keyfile;
       std::string _capath;
+      bool _sessionResumption;		// offer cached session on reconnect
+      unsigned int _sessionHits;		// handshakes that resumed a session
+      unsigned int _sessionMisses;		// handshakes that were full
+      SSL_SESSION *_session;		// last resumable session for this host
+      unsigned int _contextGeneration;	// SslContextCache generation of _session
+      connectStateEnum _state;		// where connection setup is at
+      time_t _phaseTs;			// when the current setup phase began
+      uint64_t _phaseStartUs;		// same, monotonic microseconds
+      LatencyHistogram _connectLatency;	// tcp connect times
+      LatencyHistogram _handshakeLatency;	// tls handshake times
+      FlightRecorder _flightRecorder;	// ring of recent connection events
+      time_t _resolveTimeout;		// seconds allowed for dns lookup
+      time_t _connectTimeout;		// seconds allowed for tcp connect
+      time_t _handshakeTimeout;		// seconds allowed for tls handshake
+      int _readTimeout;			// milliseconds read() waits for data
+      int _sslWant;			// SSL_ERROR_WANT_* from last handshake/flush
+      std::string _outBuffer;		// bytes waiting to go to SSL_write
+      size_t _outOffset;			// start of unwritten data in _outBuffer
+      std::string _salvaged;		// read after a failed flush, see read()
+      unsigned long long _bytesQueued;	// total bytes ever buffered
+      unsigned long long _bytesFlushed;	// total bytes SSL_write accepted
+      bool _kernelTls;			// ask for kTLS on the next connect
+      bool _ktlsSend;			// kernel is encrypting what we send
+      bool _ktlsRecv;			// kernel is decrypting what we read
+      SocketOptions _socketOptions;	// tuning applied on every connect
+      SocketSample _socketSample;		// last kernel view of the connection
 
       SSL_Connection *_sslcon;
   }; // SslController
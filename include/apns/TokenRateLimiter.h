@@ -0,0 +1,112 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_TOKENRATELIMITER_H
+#define LIBAPNS_TOKENRATELIMITER_H
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ApnsAbstract.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  typedef struct {
+    uint32_t fingerprint;			// second half of the owner's token hash, 0 if unused
+    uint32_t window;				// which window current counts
+    uint16_t previous;				// sends in the window before it
+    uint16_t current;				// sends so far in this window
+  } TokenRateLimiter_Slot;
+
+  class TokenRateLimiter_Exception : public ApnsAbstract_Exception {
+    public:
+      TokenRateLimiter_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class TokenRateLimiter_Exception
+
+  // Allows each device token limit() messages per window() seconds using
+  // a sliding window estimate: the previous window's count, weighted by
+  // how much of it still overlaps, plus the current one.  Tokens hash
+  // into a fixed table of 12 byte slots, so memory never grows.  A token
+  // that collides with another only takes the slot over once it has gone
+  // a full window unused; until then the two share one count, which errs
+  // on the side of limiting.
+  //
+  // Shared between controllers, possibly on different threads.
+  class TokenRateLimiter {
+    public:
+      TokenRateLimiter(const unsigned int, const time_t, const size_t);
+      virtual ~TokenRateLimiter();
+
+      /**********************
+       ** Type Definitions **
+       **********************/
+      static const size_t DEFAULT_SLOTS;
+
+      /***************
+       ** Variables **
+       ***************/
+      const inline unsigned int limit() const { return _limit; }
+      const inline time_t window() const { return _window; }
+      const inline size_t slots() const { return _slots.size(); }
+      const inline unsigned long long numAllowed() const { return _numAllowed; }
+      const inline unsigned long long numLimited() const { return _numLimited; }
+
+      // Counts the message and returns true if the token is under its
+      // limit, otherwise leaves the count alone and returns false.
+      const bool allow(const std::string &);
+
+    protected:
+    private:
+      static const uint64_t _hash(const std::string &);
+
+      pthread_mutex_t _mutex;			// guards _slots and the counters
+      std::vector<TokenRateLimiter_Slot> _slots;	// power of two sized
+      unsigned int _limit;			// messages per window per token
+      time_t _window;				// seconds
+      unsigned long long _numAllowed;		// messages let through
+      unsigned long long _numLimited;		// messages turned away
+  }; // TokenRateLimiter
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
@@ -28,8 +28,19 @@
 
 #include "ApnsAbstract.h"
 #include "ApnsMessage.h"
+#include "FlightRecorder.h"
+#include "LatencyHistogram.h"
+#include "MetricsRegistry.h"
+#include "Resolver.h"
+#include "ResolverCache.h"
+#include "SslContextCache.h"
 #include "SslController.h"
 #include "PushController.h"
+#include "PushDispatcher.h"
+#include "PushManager.h"
 #include "FeedbackController.h"
+#include "FeedbackLog.h"
+#include "DeadTokenFilter.h"
+#include "TokenRateLimiter.h"
 
 #endif
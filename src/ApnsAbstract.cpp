@@ -100,6 +100,8 @@ namespace apns {
     return s.str();
   } // ApnsAbstract::_binaryToDeviceToken
 
+  int ApnsAbstract::_logLevel		= LogDebug;
+
   const std::string ApnsAbstract::_char2hex(const char dec) {
     char dig1 = (dec&0xF0)>>4;
     char dig2 = (dec&0x0F);
@@ -136,27 +138,36 @@ namespace apns {
     _deviceTokenToBinary(binaryDeviceToken, deviceTokenOrig, DEVICE_BINARY_SIZE);
     deviceToken = _binaryToDeviceToken(binaryDeviceToken, DEVICE_BINARY_SIZE);
 
-    LOG(LogInfo, << "Testing deviceTokenOrig tools: "
-                 << deviceTokenOrig
-                 << std::endl);
-    LOG(LogInfo, << "Testing deviceToken     tools: "
-                 << deviceToken
-                 << std::endl);
+    APNS_LOG(LogInfo, << "Testing deviceTokenOrig tools: "
+                      << deviceTokenOrig
+                      << std::endl);
+    APNS_LOG(LogInfo, << "Testing deviceToken     tools: "
+                      << deviceToken
+                      << std::endl);
 
     return true;
   } // ApnsAbstract::_testDeviceTokenTools
 
   const std::string ApnsAbstract::_safeBinaryOutput(const char *ptr, const size_t len) {
-    std::stringstream s;
-    s.str("");
+    static const char hex[] = "0123456789abcdef";
+    std::string s;
+
+    // only ever called for debug output, but keep it to one allocation
+    s.reserve(len * 2);
 
     for(size_t i=0; i < len; i++) {
-      if ((int) ptr[i] < 32 || (int) ptr[i] > 126)
-        s << "[\\x" << _char2hex(ptr[i]) << "]";
+      const unsigned char ch = ptr[i];
+
+      if (ch < 32 || ch > 126) {
+        s += "[\\x";
+        s += hex[ch >> 4];
+        s += hex[ch & 0x0f];
+        s += ']';
+      } // if
       else
-        s << ptr[i];
+        s += ch;
     } // for
 
-    return s.str();
+    return s;
   } // ApnsAbstract::_safeBinaryOutput
 } // namespace apns
@@ -37,6 +37,7 @@
 #include <fstream>
 #include <sstream>
 
+#include <ctype.h>
 #include <time.h>
 
 #include <openframe/openframe.h>
@@ -53,6 +54,7 @@ namespace apns {
   const unsigned int ApnsMessage::DEFAULT_MAXIMUM_RETRIES 	= 3;
   const unsigned int ApnsMessage::MAXIMUM_DICTIONARY_VALUES 	= 5;
   const unsigned int ApnsMessage::DEFAULT_EXPIRY	 	= 60;
+  const unsigned int ApnsMessage::MAXIMUM_PAYLOAD_DEPTH 	= 32;
 
   ApnsMessage::ApnsMessage(const std::string &deviceToken) :
     _deviceToken(deviceToken), _actionKeyCaption("View") {
@@ -66,6 +68,11 @@ namespace apns {
     _maxRetries = DEFAULT_MAXIMUM_RETRIES;
     _expiry = time(NULL) + DEFAULT_EXPIRY;
     _retries = 0;
+    _id = 0;
+    _raw = false;
+    _queuedUs = 0;
+    _writtenUs = 0;
+    _outcomeReported = false;
 
     return;
   } // PushController::PushController
@@ -76,6 +83,31 @@ namespace apns {
   } // ApnsMessage::~ApnsMessage
 
   const std::string ApnsMessage::getPayload() {
+    return getPayload(PAYLOAD_MAXIMUM_SIZE);
+  } // ApnsMessage::getPayload
+
+  const std::string ApnsMessage::getPayload(const size_t maxSize) {
+    return _buildPayload(maxSize);
+  } // ApnsMessage::getPayload
+
+  void ApnsMessage::payload(std::string &payload) {
+    if (!isValidPayload(payload.data(), payload.length()))
+      throw ApnsMessage_Exception("Invalid payload.");
+
+    // take ownership of the caller's buffer without copying it
+    _payload.swap(payload);
+    payload.clear();
+    _raw = true;
+  } // ApnsMessage::payload
+
+  const std::string &ApnsMessage::_buildPayload(const size_t maxSize) {
+    if (_raw) {
+      if (_payload.length() > maxSize)
+        throw ApnsMessage_Exception("Payload exceeds maximum size.");
+
+      return _payload;
+    } // if
+
     std::stringstream s;
 
     s.str("");
@@ -121,11 +153,91 @@ namespace apns {
 
     s << "}";
 
-    if (s.str().length() > PAYLOAD_MAXIMUM_SIZE)
+    _payload = s.str();
+
+    if (_payload.length() > maxSize)
       throw ApnsMessage_Exception("Payload exceeds maximum size.");
 
-    return s.str();
-  } // ApnsMessage::getPayload
+    return _payload;
+  } // ApnsMessage::_buildPayload
+
+  // Single pass structural check of a pre-built JSON payload; verifies
+  // that it is one object with balanced brackets and well formed strings
+  // without doing a full parse.
+  const bool ApnsMessage::isValidPayload(const char *payload, const size_t len) {
+    char closers[MAXIMUM_PAYLOAD_DEPTH];
+    unsigned int depth = 0;
+    size_t i = 0;
+
+    while(i < len && isspace((unsigned char) payload[i]))
+      i++;
+
+    if (i == len || payload[i] != '{')
+      return false;
+
+    for(; i < len; i++) {
+      const char ch = payload[i];
+
+      switch(ch) {
+        case '{':
+        case '[':
+          if (depth == MAXIMUM_PAYLOAD_DEPTH)
+            return false;
+          closers[depth++] = (ch == '{' ? '}' : ']');
+          break;
+        case '}':
+        case ']':
+          if (!depth || closers[--depth] != ch)
+            return false;
+
+          if (!depth) {
+            // top level object closed, only whitespace may follow
+            for(i++; i < len; i++) {
+              if (!isspace((unsigned char) payload[i]))
+                return false;
+            } // for
+            return true;
+          } // if
+          break;
+        case '"':
+          for(i++; i < len && payload[i] != '"'; i++) {
+            if ((unsigned char) payload[i] < 0x20)
+              return false;
+
+            if (payload[i] != '\\')
+              continue;
+
+            if (++i == len)
+              return false;
+
+            if (payload[i] == 'u') {
+              if (i + 4 >= len)
+                return false;
+
+              for(size_t j = i + 1; j <= i + 4; j++) {
+                if (!isxdigit((unsigned char) payload[j]))
+                  return false;
+              } // for
+              i += 4;
+            } // if
+            else if (!payload[i] || !strchr("\"\\/bfnrt", payload[i]))
+              return false;
+          } // for
+
+          if (i == len)
+            return false;
+          break;
+        case '\0':
+          return false;
+          break;
+        default:
+          break;
+      } // switch
+    } // for
+
+    // ran out of input before the top level object was closed
+    return false;
+  } // ApnsMessage::isValidPayload
 
   const std::string ApnsMessage::escape(const std::string &escape) {
     std::string ret = "";
@@ -0,0 +1,218 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openframe/openframe.h>
+
+#include "DeadTokenFilter.h"
+#include "FeedbackLog.h"
+
+namespace apns {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** DeadTokenFilter Class                                                **
+ **************************************************************************/
+  static bool tokenLess(const FeedbackRecord &a, const FeedbackRecord &b) {
+    return memcmp(a.deviceToken, b.deviceToken, DEVICE_BINARY_SIZE) < 0;
+  } // tokenLess
+
+  DeadTokenFilter::DeadTokenFilter() {
+    pthread_mutex_init(&_mutex, NULL);
+
+    return;
+  } // DeadTokenFilter::DeadTokenFilter
+
+  DeadTokenFilter::~DeadTokenFilter() {
+    pthread_mutex_destroy(&_mutex);
+
+    return;
+  } // DeadTokenFilter::~DeadTokenFilter
+
+  void DeadTokenFilter::_toBinary(FeedbackRecord &record, const std::string &deviceToken) {
+    memset(record.deviceToken, '\0', DEVICE_BINARY_SIZE);
+    _deviceTokenToBinary((char *) record.deviceToken, deviceToken, DEVICE_BINARY_SIZE);
+  } // DeadTokenFilter::_toBinary
+
+  DeadTokenFilter::tokenVectorType::iterator DeadTokenFilter::_find(const unsigned char *deviceToken) {
+    tokenVectorType::iterator ptr;
+    FeedbackRecord key;
+
+    memcpy(key.deviceToken, deviceToken, DEVICE_BINARY_SIZE);
+
+    ptr = std::lower_bound(_tokens.begin(), _tokens.end(), key, tokenLess);
+    if (ptr != _tokens.end() && feedbackRecordSameToken(*ptr, key))
+      return ptr;
+
+    return _tokens.end();
+  } // DeadTokenFilter::_find
+
+  // Merge a batch in, keeping the newest report for each token.
+  void DeadTokenFilter::onFeedback(const FeedbackRecord *records, const size_t numRecords) {
+    size_t mid;
+
+    if (!numRecords)
+      return;
+
+    pthread_mutex_lock(&_mutex);
+
+    mid = _tokens.size();
+    _tokens.insert(_tokens.end(), records, records + numRecords);
+    std::sort(_tokens.begin() + mid, _tokens.end(), feedbackRecordLess);
+    std::inplace_merge(_tokens.begin(), _tokens.begin() + mid, _tokens.end(), feedbackRecordLess);
+    _tokens.erase(std::unique(_tokens.begin(), _tokens.end(), feedbackRecordSameToken), _tokens.end());
+
+    pthread_mutex_unlock(&_mutex);
+  } // DeadTokenFilter::onFeedback
+
+  void DeadTokenFilter::add(const std::string &deviceToken, const time_t timestamp) {
+    FeedbackRecord record;
+
+    _toBinary(record, deviceToken);
+    record.timestamp = timestamp;
+
+    onFeedback(&record, 1);
+  } // DeadTokenFilter::add
+
+  // The app registered the token at the given time; if that is after APNs
+  // reported it dead the device has the app again.
+  const bool DeadTokenFilter::registered(const std::string &deviceToken, const time_t timestamp) {
+    tokenVectorType::iterator ptr;
+    FeedbackRecord record;
+    bool ret = false;
+
+    _toBinary(record, deviceToken);
+
+    pthread_mutex_lock(&_mutex);
+
+    ptr = _find(record.deviceToken);
+    if (ptr != _tokens.end() && timestamp > ptr->timestamp) {
+      _tokens.erase(ptr);
+      ret = true;
+    } // if
+
+    pthread_mutex_unlock(&_mutex);
+
+    return ret;
+  } // DeadTokenFilter::registered
+
+  const bool DeadTokenFilter::isDead(const std::string &deviceToken) {
+    FeedbackRecord record;
+
+    if (!size())
+      return false;
+
+    _toBinary(record, deviceToken);
+
+    return isDead(record.deviceToken);
+  } // DeadTokenFilter::isDead
+
+  const bool DeadTokenFilter::isDead(const unsigned char *deviceToken) {
+    bool ret;
+
+    pthread_mutex_lock(&_mutex);
+    ret = _find(deviceToken) != _tokens.end();
+    pthread_mutex_unlock(&_mutex);
+
+    return ret;
+  } // DeadTokenFilter::isDead
+
+  const size_t DeadTokenFilter::size() {
+    size_t ret;
+
+    pthread_mutex_lock(&_mutex);
+    ret = _tokens.size();
+    pthread_mutex_unlock(&_mutex);
+
+    return ret;
+  } // DeadTokenFilter::size
+
+  void DeadTokenFilter::clear() {
+    pthread_mutex_lock(&_mutex);
+    tokenVectorType().swap(_tokens);
+    pthread_mutex_unlock(&_mutex);
+  } // DeadTokenFilter::clear
+
+  // Merges a snapshot (or any feedback log) into what we have; throws
+  // FeedbackLog_Exception if it can't be read.
+  const size_t DeadTokenFilter::load(const std::string &path) {
+    FeedbackLogReader reader(path);
+
+    reader.scan(this);
+
+    APNS_LOG(LogInfo, << "Loaded "
+                      << reader.size()
+                      << " dead tokens from "
+                      << path
+                      << std::endl);
+
+    return reader.size();
+  } // DeadTokenFilter::load
+
+  // Written next to the target and renamed over it, so a crash leaves
+  // either the old snapshot or the new one.
+  const bool DeadTokenFilter::save(const std::string &path) {
+    const std::string tmpPath = path + ".tmp";
+    tokenVectorType tokens;
+    bool ret;
+
+    pthread_mutex_lock(&_mutex);
+    tokens = _tokens;
+    pthread_mutex_unlock(&_mutex);
+
+    unlink(tmpPath.c_str());
+
+    try {
+      FeedbackLog log(tmpPath, FeedbackLog::SYNC_NEVER);
+
+      ret = log.append(tokens.empty() ? NULL : &tokens[0], tokens.size()) && log.sync();
+    } // try
+    catch(FeedbackLog_Exception &e) {
+      APNS_LOG(LogWarn, << "Unable to save dead tokens: "
+                        << e.message()
+                        << std::endl);
+      return false;
+    } // catch
+
+    if (!ret || rename(tmpPath.c_str(), path.c_str()) == -1) {
+      APNS_LOG(LogWarn, << "Unable to save dead tokens to "
+                        << path
+                        << std::endl);
+      unlink(tmpPath.c_str());
+      return false;
+    } // if
+
+    return true;
+  } // DeadTokenFilter::save
+} // namespace apns
@@ -33,6 +33,7 @@
 #include <list>
 #include <map>
 #include <new>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -55,6 +56,8 @@
 
 #include "ApnsMessage.h"
 #include "FeedbackController.h"
+#include "FeedbackLog.h"
+#include "DeadTokenFilter.h"
 
 namespace apns {
   using namespace openframe::loglevel;
@@ -63,48 +66,148 @@ namespace apns {
  ** APNS Class                                                           **
  **************************************************************************/
 
+  // Orders by token and newest first within a token, so the record we
+  // keep for each token is the first of its run.
+  bool feedbackRecordLess(const FeedbackRecord &a, const FeedbackRecord &b) {
+    int ret = memcmp(a.deviceToken, b.deviceToken, DEVICE_BINARY_SIZE);
+
+    if (ret)
+      return ret < 0;
+
+    return a.timestamp > b.timestamp;
+  } // feedbackRecordLess
+
+  bool feedbackRecordSameToken(const FeedbackRecord &a, const FeedbackRecord &b) {
+    return memcmp(a.deviceToken, b.deviceToken, DEVICE_BINARY_SIZE) == 0;
+  } // feedbackRecordSameToken
+
   const int FeedbackController::FEEDBACK_RESPONSE_SIZE	= 38;
+  const size_t FeedbackController::FEEDBACK_HEADER_SIZE	= 6;		// timestamp + token length
+  const size_t FeedbackController::FEEDBACK_READ_BUFFER_SIZE	= 65536;
+  const time_t FeedbackController::FEEDBACK_READ_TIMEOUT	= 5;
+  const unsigned int FeedbackController::FEEDBACK_BUSY_RECORDS	= 100;
 
   FeedbackController::FeedbackController(const std::string &host, const int port, const std::string &certfile, const std::string &keyfile, const std::string &capath, const time_t timeout) :
     SslController(host, port, certfile, keyfile, capath), _timeout(timeout) {
 
     _nextCheckTs = time(NULL) + timeout;
+    _pollInterval = timeout;
+    _minimumPollInterval = 0;
+    _maximumPollInterval = 0;
+    _readLength = 0;
+    _polling = false;
+    _pollStartUs = 0;
+    _lastReadTs = 0;
+    _pollRecords = 0;
+    _lastPollRecords = 0;
+    _feedbackHandler = NULL;
+    _feedbackLog = NULL;
+    _deadTokenFilter = NULL;
 
     return;
   } // FeedbackController::FeedbackController
 
   FeedbackController::~FeedbackController() {
-    if (isConnected())
+    if (isConnected() || isConnecting())
       disconnect();
 
     return;
   } // FeedbackController::~FeedbackController
 
+  // The feedback service writes every record it has queued for us and
+  // then closes the connection; each run() reads what has arrived so far
+  // and the poll ends at EOF, or once the service goes quiet.
   const bool FeedbackController::run() {
-    if (time(NULL) < _nextCheckTs)
-      return false;
+    // a connect or response already under way is driven every run
+    if (!isConnecting() && !_polling) {
+      if (time(NULL) < _nextCheckTs)
+        return false;
 
-    _nextCheckTs = time(NULL)+_timeout;
+      _nextCheckTs = time(NULL)+_pollInterval;
+      _pollStartUs = LatencyHistogram::now();
+    } // if
 
     if (!isConnected() && !connect()) {
-      LOG(LogWarn, << "Could not connect to feedback server, will try again later."
-                   << std::endl);
+      if (isConnecting())
+        return false;
+
+      APNS_LOG(LogWarn, << "Could not connect to feedback server, will try again later."
+                        << std::endl);
       return false;
     } // if
 
-    LOG(LogNotice, << "Checking APNS feedback servers after "
-                   << _timeout
-                   << " seconds."
-                   << std::endl);
-    _readFeedbackFromApns();
+    if (!_polling) {
+      APNS_LOG(LogNotice, << "Checking APNS feedback servers after "
+                          << _pollInterval
+                          << " seconds."
+                          << std::endl);
+      _polling = true;
+      _pollRecords = 0;
+      _readLength = 0;
+      _lastReadTs = time(NULL);
+    } // if
+
+    _pollRecords += _readFeedbackFromApns();
 
     //_testFeedbackResponse();
 
-    disconnect();
+    if (isConnected() && time(NULL) < _lastReadTs + FEEDBACK_READ_TIMEOUT)
+      return true;
+
+    if (isConnected())
+      disconnect();
+
+    _finishPoll();
 
     return true;
   } // PushController::run
 
+  // Lots of feedback means tokens are going stale quickly, come back
+  // sooner; none at all means we can afford to ask less often.
+  void FeedbackController::_finishPoll() {
+    time_t minimum = _minimumPollInterval ? _minimumPollInterval : _timeout / 4;
+    time_t maximum = _maximumPollInterval ? _maximumPollInterval : _timeout * 4;
+
+    if (_readLength)
+      APNS_LOG(LogWarn, << "Feedback response ended with a partial record ("
+                        << _readLength
+                        << " bytes), discarding."
+                        << std::endl);
+
+    if (_pollRecords >= FEEDBACK_BUSY_RECORDS)
+      _pollInterval /= 2;
+    else if (!_pollRecords)
+      _pollInterval *= 2;
+
+    if (_pollInterval < minimum)
+      _pollInterval = minimum;
+    if (_pollInterval > maximum)
+      _pollInterval = maximum;
+    if (_pollInterval < 1)
+      _pollInterval = 1;
+
+    _deliverRecords();
+
+    _nextCheckTs = time(NULL) + _pollInterval;
+    _lastPollRecords = _pollRecords;
+    _pollLatency.recordSince(_pollStartUs);
+    _polling = false;
+    _readLength = 0;
+
+    // a poll every few minutes doesn't need to hold on to the buffer
+    std::vector<char>().swap(_readBuffer);
+
+    APNS_LOG(LogNotice, << "Feedback poll read "
+                        << _lastPollRecords
+                        << " record"
+                        << (_lastPollRecords == 1 ? "" : "s")
+                        << ", next in "
+                        << _pollInterval
+                        << " seconds, durations in microseconds "
+                        << _pollLatency.summary()
+                        << std::endl);
+  } // FeedbackController::_finishPoll
+
   void FeedbackController::_testFeedbackResponse() {
     ApnsFeedbackResponse_t r;
     time_t now = time(NULL);
@@ -120,50 +223,132 @@ namespace apns {
     memcpy(&r.tokenLen, &tokenLen, sizeof(uint16_t));
     memcpy(&r.deviceToken, &binaryDeviceToken, DEVICE_BINARY_SIZE);
 
-    LOG(LogInfo, << "Testing FeedbackResponse system with timestamp("
-                 << now
-                 << ") tokenLen("
-                 << DEVICE_BINARY_SIZE
-                 << ") deviceToken("
-                 << deviceToken
-                 << ") packetLen("
-                 << packetLen
-                 << ")"
-                 << std::endl);
-    LOG(LogDebug, << "TST |"
-                  << _safeBinaryOutput((char *) &r, packetLen)
-                  << "|"
-                  << std::endl);
+    APNS_LOG(LogInfo, << "Testing FeedbackResponse system with timestamp("
+                      << now
+                      << ") tokenLen("
+                      << DEVICE_BINARY_SIZE
+                      << ") deviceToken("
+                      << deviceToken
+                      << ") packetLen("
+                      << packetLen
+                      << ")"
+                      << std::endl);
+    APNS_LOG(LogDebug, << "TST |"
+                       << _safeBinaryOutput((char *) &r, packetLen)
+                       << "|"
+                       << std::endl);
 
     _processFeedbackFromApns(&r);
   } // FeedbackController::_testFeedbackResponse
 
-  void FeedbackController::_readFeedbackFromApns() {
-    ApnsFeedbackResponse_t r;
-    char response[FEEDBACK_RESPONSE_SIZE];
-    char *ptr = response;
-    int ret;
+  // Sort and deduplicate in place, so handing a poll's worth of feedback
+  // to the handler costs no allocation once _records has grown.
+  void FeedbackController::_deliverRecords() {
+    std::vector<FeedbackRecord>::iterator end;
 
-    ret = read((void *) &response, FEEDBACK_RESPONSE_SIZE);
+    size_t numRecords;
 
-    if (ret < 1)
+    if ((_feedbackHandler == NULL && _feedbackLog == NULL && _deadTokenFilter == NULL)
+        || _records.empty())
       return;
 
-    memcpy(&r.timestamp, ptr, sizeof(uint32_t));
-    ptr += sizeof(uint32_t);
-    memcpy(&r.tokenLen, ptr, sizeof(uint16_t));
-    ptr += sizeof(uint16_t);
-    memcpy(&r.deviceToken, ptr, DEVICE_BINARY_SIZE);
+    std::sort(_records.begin(), _records.end(), feedbackRecordLess);
+    end = std::unique(_records.begin(), _records.end(), feedbackRecordSameToken);
 
-    LOG(LogDebug, << "Received feedback from APNS that was "
-                  << ret
-                  << " bytes."
-                  << std::endl);
+    if (_records.end() - end > 0)
+      APNS_LOG(LogDebug, << "Dropped "
+                         << (_records.end() - end)
+                         << " repeated feedback tokens."
+                         << std::endl);
 
-    _processFeedbackFromApns(&r);
+    numRecords = end - _records.begin();
+
+    if (_feedbackLog != NULL && !_feedbackLog->append(&_records[0], numRecords))
+      APNS_LOG(LogWarn, << "Unable to log "
+                        << numRecords
+                        << " feedback records to "
+                        << _feedbackLog->path()
+                        << std::endl);
+
+    if (_deadTokenFilter != NULL)
+      _deadTokenFilter->onFeedback(&_records[0], numRecords);
+
+    if (_feedbackHandler != NULL)
+      _feedbackHandler->onFeedback(&_records[0], numRecords);
+
+    _records.clear();
+  } // FeedbackController::_deliverRecords
+
+  // Read everything the connection has for us right now and parse every
+  // complete record out of the buffer; a record split across reads stays
+  // at the front of the buffer until the rest of it arrives.
+  const unsigned int FeedbackController::_readFeedbackFromApns() {
+    unsigned int numRecords = 0;
+    uint16_t tokenLen;
+    size_t offset;
+    int ret;
+
+    if (_readBuffer.size() < FEEDBACK_READ_BUFFER_SIZE)
+      _readBuffer.resize(FEEDBACK_READ_BUFFER_SIZE);
+
+    while(isConnected()) {
+      ret = read((void *) &_readBuffer[_readLength], _readBuffer.size() - _readLength);
+
+      if (ret < 1)
+        break;
+
+      APNS_LOG(LogDebug, << "Received feedback from APNS that was "
+                         << ret
+                         << " bytes."
+                         << std::endl);
+
+      _readLength += ret;
+      _lastReadTs = time(NULL);
+
+      for(offset = 0; _readLength - offset >= FEEDBACK_HEADER_SIZE; offset += FEEDBACK_HEADER_SIZE + tokenLen) {
+        memcpy(&tokenLen, &_readBuffer[offset + sizeof(uint32_t)], sizeof(uint16_t));
+        tokenLen = ntohs(tokenLen);
+
+        if (tokenLen != DEVICE_BINARY_SIZE) {
+          // we can't find the next record boundary we can trust
+          APNS_LOG(LogWarn, << "Feedback record with token length "
+                            << tokenLen
+                            << ", dropping the rest of the response."
+                            << std::endl);
+          disconnect();
+          _readLength = offset = 0;
+          break;
+        } // if
+
+        if (_readLength - offset < FEEDBACK_HEADER_SIZE + tokenLen)
+          break;
+
+        _processFeedbackFromApns((const ApnsFeedbackResponse_t *) &_readBuffer[offset]);
+        numRecords++;
+      } // for
+
+      if (offset) {
+        memmove(&_readBuffer[0], &_readBuffer[offset], _readLength - offset);
+        _readLength -= offset;
+      } // if
+    } // while
+
+    return numRecords;
   } // FeedbackController::_readFeedbackFromApns
 
   void FeedbackController::_processFeedbackFromApns(const ApnsFeedbackResponse_t *r) {
+    if (_feedbackHandler != NULL || _feedbackLog != NULL || _deadTokenFilter != NULL) {
+      FeedbackRecord record;
+      uint32_t networkOrderTimestamp;
+
+      memcpy(&networkOrderTimestamp, r->timestamp, sizeof(uint32_t));
+      record.timestamp = ntohl(networkOrderTimestamp);
+      memcpy(record.deviceToken, r->deviceToken, DEVICE_BINARY_SIZE);
+
+      _records.push_back(record);
+      return;
+    } // if
+
     FeedbackMessage *aFbMessage;
     time_t timestamp;
     char binaryDeviceToken[DEVICE_BINARY_SIZE];
@@ -185,14 +370,14 @@ namespace apns {
     aFbMessage = new FeedbackMessage(timestamp, tokenLen, deviceToken);
     _messageFeedbackQueue.insert(aFbMessage);
 
-    LOG(LogInfo, << "INFO: Feedback response: timestamp("
-                 << timestamp
-                 << ") tokenLen("
-                 << tokenLen
-                 << ") deviceToken("
-                 << deviceToken
-                 << ")"
-                 << std::endl);
+    APNS_LOG(LogInfo, << "INFO: Feedback response: timestamp("
+                      << timestamp
+                      << ") tokenLen("
+                      << tokenLen
+                      << ") deviceToken("
+                      << deviceToken
+                      << ")"
+                      << std::endl);
 
   } // PushController::_processFeedbackFromApns
 } // namespace apns
@@ -0,0 +1,291 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <openframe/openframe.h>
+
+#include "FeedbackLog.h"
+
+namespace apns {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** FeedbackLog Class                                                    **
+ **************************************************************************/
+  const char FeedbackLog::MAGIC[8]			= { 'A', 'P', 'N', 'S', 'F', 'B', 'K', '\0' };
+  const uint32_t FeedbackLog::VERSION			= 1;
+  const time_t FeedbackLog::DEFAULT_SYNC_INTERVAL	= 5;
+
+  FeedbackLog::FeedbackLog(const std::string &path, const fsyncPolicyEnum fsyncPolicy) :
+    _path(path), _fsyncPolicy(fsyncPolicy) {
+
+    _fd = -1;
+    _syncInterval = DEFAULT_SYNC_INTERVAL;
+    _lastSyncTs = time(NULL);
+    _dirty = false;
+
+    _open();
+
+    return;
+  } // FeedbackLog::FeedbackLog
+
+  FeedbackLog::~FeedbackLog() {
+    if (_fsyncPolicy != SYNC_NEVER)
+      sync();
+
+    if (_fd != -1)
+      close(_fd);
+
+    return;
+  } // FeedbackLog::~FeedbackLog
+
+  // Write the header to a new log, check it on an existing one and cut
+  // off any record torn by a crash so appends stay aligned.
+  void FeedbackLog::_open() {
+    FeedbackLog_Header_t header;
+    uint32_t version = htonl(VERSION);
+    uint32_t recordSize = htonl(sizeof(FeedbackLog_Record_t));
+    struct stat st;
+    off_t whole;
+
+    if ((_fd = open(_path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644)) == -1)
+      throw FeedbackLog_Exception("Unable to open " + _path + ": " + strerror(errno));
+
+    if (fstat(_fd, &st) == -1) {
+      close(_fd);
+      throw FeedbackLog_Exception("Unable to stat " + _path + ": " + strerror(errno));
+    } // if
+
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    memcpy(header.version, &version, sizeof(uint32_t));
+    memcpy(header.recordSize, &recordSize, sizeof(uint32_t));
+
+    if (st.st_size == 0) {
+      if (!_write((const char *) &header, sizeof(header))) {
+        close(_fd);
+        throw FeedbackLog_Exception("Unable to write header to " + _path);
+      } // if
+      return;
+    } // if
+
+    FeedbackLog_Header_t existing;
+    if (st.st_size < (off_t) sizeof(existing)
+        || pread(_fd, &existing, sizeof(existing), 0) != (ssize_t) sizeof(existing)
+        || memcmp(&existing, &header, sizeof(header))) {
+      close(_fd);
+      throw FeedbackLog_Exception(_path + " is not a feedback log we can append to.");
+    } // if
+
+    whole = sizeof(header) + (st.st_size - sizeof(header)) / sizeof(FeedbackLog_Record_t) * sizeof(FeedbackLog_Record_t);
+    if (whole != st.st_size) {
+      APNS_LOG(LogWarn, << "Truncating partial record at the end of "
+                        << _path
+                        << std::endl);
+
+      if (ftruncate(_fd, whole) == -1) {
+        close(_fd);
+        throw FeedbackLog_Exception("Unable to truncate " + _path + ": " + strerror(errno));
+      } // if
+    } // if
+  } // FeedbackLog::_open
+
+  const bool FeedbackLog::_write(const char *buf, size_t len) {
+    ssize_t ret;
+
+    while(len) {
+      ret = write(_fd, buf, len);
+
+      if (ret == -1) {
+        if (errno == EINTR)
+          continue;
+
+        APNS_LOG(LogWarn, << "Unable to write to "
+                          << _path
+                          << ": "
+                          << strerror(errno)
+                          << std::endl);
+        return false;
+      } // if
+
+      buf += ret;
+      len -= ret;
+    } // while
+
+    _dirty = true;
+
+    return true;
+  } // FeedbackLog::_write
+
+  const bool FeedbackLog::append(const FeedbackRecord *records, const size_t numRecords) {
+    FeedbackLog_Record_t *out;
+    uint32_t timestamp;
+    size_t i;
+
+    if (!numRecords)
+      return true;
+
+    // one write() per batch, so a batch is never interleaved with
+    // another writer's
+    _buffer.resize(numRecords * sizeof(FeedbackLog_Record_t));
+    out = (FeedbackLog_Record_t *) &_buffer[0];
+
+    for(i = 0; i < numRecords; i++) {
+      timestamp = htonl((uint32_t) records[i].timestamp);
+      memcpy(out[i].timestamp, &timestamp, sizeof(uint32_t));
+      memcpy(out[i].deviceToken, records[i].deviceToken, DEVICE_BINARY_SIZE);
+    } // for
+
+    if (!_write(&_buffer[0], _buffer.size()))
+      return false;
+
+    if (_fsyncPolicy == SYNC_ALWAYS
+        || (_fsyncPolicy == SYNC_INTERVAL && time(NULL) >= _lastSyncTs + _syncInterval))
+      return sync();
+
+    return true;
+  } // FeedbackLog::append
+
+  const bool FeedbackLog::sync() {
+    if (!_dirty)
+      return true;
+
+    if (fdatasync(_fd) == -1) {
+      APNS_LOG(LogWarn, << "Unable to sync "
+                        << _path
+                        << ": "
+                        << strerror(errno)
+                        << std::endl);
+      return false;
+    } // if
+
+    _dirty = false;
+    _lastSyncTs = time(NULL);
+
+    return true;
+  } // FeedbackLog::sync
+
+/**************************************************************************
+ ** FeedbackLogReader Class                                              **
+ **************************************************************************/
+  const size_t FeedbackLogReader::SCAN_BATCH_SIZE	= 1024;
+
+  FeedbackLogReader::FeedbackLogReader(const std::string &path) {
+    const FeedbackLog_Header_t *header;
+    uint32_t version;
+    uint32_t recordSize;
+    struct stat st;
+
+    _map = MAP_FAILED;
+    _mapLength = 0;
+
+    if ((_fd = open(path.c_str(), O_RDONLY)) == -1)
+      throw FeedbackLog_Exception("Unable to open " + path + ": " + strerror(errno));
+
+    if (fstat(_fd, &st) == -1 || st.st_size < (off_t) sizeof(FeedbackLog_Header_t)) {
+      close(_fd);
+      throw FeedbackLog_Exception(path + " is too short to be a feedback log.");
+    } // if
+
+    _mapLength = st.st_size;
+    if ((_map = mmap(NULL, _mapLength, PROT_READ, MAP_PRIVATE, _fd, 0)) == MAP_FAILED) {
+      close(_fd);
+      throw FeedbackLog_Exception("Unable to map " + path + ": " + strerror(errno));
+    } // if
+
+    header = (const FeedbackLog_Header_t *) _map;
+    memcpy(&version, header->version, sizeof(uint32_t));
+    memcpy(&recordSize, header->recordSize, sizeof(uint32_t));
+
+    if (memcmp(header->magic, FeedbackLog::MAGIC, sizeof(header->magic))
+        || ntohl(version) != FeedbackLog::VERSION
+        || ntohl(recordSize) != sizeof(FeedbackLog_Record_t)) {
+      munmap(_map, _mapLength);
+      close(_fd);
+      throw FeedbackLog_Exception(path + " is not a feedback log we can read.");
+    } // if
+
+    madvise(_map, _mapLength, MADV_SEQUENTIAL);
+
+    _records = (const FeedbackLog_Record_t *) ((const char *) _map + sizeof(FeedbackLog_Header_t));
+    _numRecords = (_mapLength - sizeof(FeedbackLog_Header_t)) / sizeof(FeedbackLog_Record_t);
+
+    return;
+  } // FeedbackLogReader::FeedbackLogReader
+
+  FeedbackLogReader::~FeedbackLogReader() {
+    munmap(_map, _mapLength);
+    close(_fd);
+
+    return;
+  } // FeedbackLogReader::~FeedbackLogReader
+
+  void FeedbackLogReader::record(const size_t i, FeedbackRecord &record) const {
+    uint32_t timestamp;
+
+    memcpy(&timestamp, _records[i].timestamp, sizeof(uint32_t));
+    record.timestamp = ntohl(timestamp);
+    memcpy(record.deviceToken, _records[i].deviceToken, DEVICE_BINARY_SIZE);
+  } // FeedbackLogReader::record
+
+  // Hands the whole log to the handler in file order, SCAN_BATCH_SIZE
+  // records at a time; unlike a poll it is not deduplicated.  The batch
+  // is allocated once on the heap, a full one is too large for the stack.
+  const size_t FeedbackLogReader::scan(FeedbackHandler *feedbackHandler) const {
+    size_t i, n = 0;
+
+    if (!_numRecords)
+      return 0;
+
+    std::vector<FeedbackRecord> batch(std::min(_numRecords, SCAN_BATCH_SIZE));
+
+    for(i = 0; i < _numRecords; i++) {
+      record(i, batch[n++]);
+
+      if (n == batch.size()) {
+        feedbackHandler->onFeedback(&batch[0], n);
+        n = 0;
+      } // if
+    } // for
+
+    if (n)
+      feedbackHandler->onFeedback(&batch[0], n);
+
+    return _numRecords;
+  } // FeedbackLogReader::scan
+} // namespace apns
@@ -0,0 +1,311 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FlightRecorder.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** FlightRecorder Class                                                 **
+ **************************************************************************/
+  const size_t FlightRecorder::DEFAULT_EVENTS		= 1024;
+  const size_t FlightRecorder::MAXIMUM_RECORDERS	= 1024;
+
+  // live recorders for dumpAll(), claimed and released with cas
+  static FlightRecorder *s_recorders[FlightRecorder::MAXIMUM_RECORDERS];
+  static unsigned int s_unregistered = 0;	// live recorders that found no slot
+  static unsigned int s_dumping = 0;		// dumpAll() calls under way
+  static int s_signalFd = -1;
+
+  static const char *s_eventNames[FLIGHT_MAX_EVENT] = {
+    "connecting", "connected", "handshake", "connect_failed", "io_error",
+    "disconnect", "frame", "error_response", "requeued", "dead_peer",
+    "idle_expired", "drained"
+  };
+
+  // Async signal safe formatting for dump(), no allocation or stdio.
+  static void appendString(char *buf, size_t &len, const size_t size, const char *str) {
+    while(*str && len < size)
+      buf[len++] = *str++;
+  } // appendString
+
+  static void appendNumber(char *buf, size_t &len, const size_t size, uint64_t number, const unsigned int width) {
+    char digits[24];
+    unsigned int i = 0;
+
+    do {
+      digits[i++] = '0' + number % 10;
+      number /= 10;
+    } while(number || i < width);
+
+    while(i && len < size)
+      buf[len++] = digits[--i];
+  } // appendNumber
+
+  static const bool writeAll(const int fd, const char *buf, const size_t len) {
+    size_t offset = 0;
+    ssize_t ret;
+
+    while(offset < len) {
+      ret = ::write(fd, buf + offset, len - offset);
+      if (ret == -1 && errno == EINTR)
+        continue;
+      if (ret < 1)
+        return false;
+      offset += ret;
+    } // while
+
+    return true;
+  } // writeAll
+
+  FlightRecorder::FlightRecorder(const size_t events) {
+    FlightRecorder_Event empty;
+    size_t size = 1;
+    size_t i;
+
+    while(size < events)
+      size <<= 1;
+
+    memset(&empty, '\0', sizeof(empty));
+    _events.assign(size, empty);
+    _mask = size - 1;
+    _next = 0;
+    _enabled = true;
+    _registered = false;
+    _name[0] = '\0';
+
+    for(i = 0; i < MAXIMUM_RECORDERS && !_registered; i++)
+      _registered = __sync_bool_compare_and_swap(&s_recorders[i], (FlightRecorder *) NULL, this);
+
+    if (!_registered)
+      __sync_fetch_and_add(&s_unregistered, 1);
+
+    return;
+  } // FlightRecorder::FlightRecorder
+
+  // Unregister first, then wait out any dumpAll() that may have picked
+  // us up before _events goes away with the members.
+  FlightRecorder::~FlightRecorder() {
+    size_t i;
+
+    _enabled = false;
+
+    if (!_registered) {
+      __sync_fetch_and_sub(&s_unregistered, 1);
+      return;
+    } // if
+
+    for(i = 0; i < MAXIMUM_RECORDERS; i++) {
+      if (__sync_bool_compare_and_swap(&s_recorders[i], this, (FlightRecorder *) NULL))
+        break;
+    } // for
+
+    while(__sync_fetch_and_add(&s_dumping, 0))
+      sched_yield();
+
+    return;
+  } // FlightRecorder::~FlightRecorder
+
+  const unsigned int FlightRecorder::numUnregistered() {
+    return __sync_fetch_and_add(&s_unregistered, 0);
+  } // FlightRecorder::numUnregistered
+
+  void FlightRecorder::name(const std::string &name) {
+    strncpy(_name, name.c_str(), sizeof(_name) - 1);
+    _name[sizeof(_name) - 1] = '\0';
+  } // FlightRecorder::name
+
+  const uint64_t FlightRecorder::_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  } // FlightRecorder::_now
+
+  void FlightRecorder::_copyToken(char *to, const char *token) {
+    size_t i;
+
+    for(i = 0; i < FLIGHT_TOKEN_PREFIX_SIZE; i++) {
+      if (token == NULL || !token[i]) {
+        memset(to + i, '\0', FLIGHT_TOKEN_PREFIX_SIZE - i);
+        return;
+      } // if
+      to[i] = token[i];
+    } // for
+  } // FlightRecorder::_copyToken
+
+  const char *FlightRecorder::eventName(const unsigned int type) {
+    return type < FLIGHT_MAX_EVENT ? s_eventNames[type] : "unknown";
+  } // FlightRecorder::eventName
+
+  // A slot is only taken if its sequence is the one we expect before and
+  // after copying it; otherwise the writer lapped us and it is skipped.
+  const size_t FlightRecorder::snapshot(std::vector<FlightRecorder_Event> &events) const {
+    const uint64_t next = __sync_fetch_and_add(const_cast<uint64_t *>(&_next), 0);
+    uint64_t pos = next > _events.size() ? next - _events.size() : 0;
+    FlightRecorder_Event e;
+
+    events.clear();
+    events.reserve(next - pos);
+
+    for(; pos < next; pos++) {
+      const FlightRecorder_Event *slot = &_events[pos & _mask];
+
+      if (slot->seq != pos + 1)
+        continue;
+      __sync_synchronize();
+      e = *slot;
+      __sync_synchronize();
+      if (slot->seq != pos + 1)
+        continue;
+
+      events.push_back(e);
+    } // for
+
+    return events.size();
+  } // FlightRecorder::snapshot
+
+  // One line per event, oldest first, timed relative to the newest:
+  //   -12.345ms frame id=17 token=5b2a90c1 status=1 value=127
+  const bool FlightRecorder::dump(const int fd) const {
+    const uint64_t next = __sync_fetch_and_add(const_cast<uint64_t *>(&_next), 0);
+    uint64_t pos = next > _events.size() ? next - _events.size() : 0;
+    const FlightRecorder_Event *newest = next ? &_events[(next - 1) & _mask] : NULL;
+    const uint64_t newestUs = newest != NULL ? newest->us : 0;
+    FlightRecorder_Event e;
+    char line[192];
+    char token[FLIGHT_TOKEN_PREFIX_SIZE + 1];
+    size_t len = 0;
+    uint64_t ago;
+
+    appendString(line, len, sizeof(line), "flight recorder ");
+    appendString(line, len, sizeof(line), _name[0] ? _name : "(unnamed)");
+    appendString(line, len, sizeof(line), ", ");
+    appendNumber(line, len, sizeof(line), next - pos, 0);
+    appendString(line, len, sizeof(line), " events\n");
+    if (!writeAll(fd, line, len))
+      return false;
+
+    for(; pos < next; pos++) {
+      const FlightRecorder_Event *slot = &_events[pos & _mask];
+
+      if (slot->seq != pos + 1)
+        continue;
+      __sync_synchronize();
+      e = *slot;
+      __sync_synchronize();
+      if (slot->seq != pos + 1)
+        continue;
+
+      memcpy(token, e.token, FLIGHT_TOKEN_PREFIX_SIZE);
+      token[FLIGHT_TOKEN_PREFIX_SIZE] = '\0';
+      ago = newestUs > e.us ? newestUs - e.us : 0;
+
+      len = 0;
+      appendString(line, len, sizeof(line), "  -");
+      appendNumber(line, len, sizeof(line), ago / 1000, 0);
+      appendString(line, len, sizeof(line), ".");
+      appendNumber(line, len, sizeof(line), ago % 1000, 3);
+      appendString(line, len, sizeof(line), "ms ");
+      appendString(line, len, sizeof(line), eventName(e.type));
+      appendString(line, len, sizeof(line), " id=");
+      appendNumber(line, len, sizeof(line), e.id, 0);
+      appendString(line, len, sizeof(line), " token=");
+      appendString(line, len, sizeof(line), token[0] ? token : "-");
+      appendString(line, len, sizeof(line), " status=");
+      appendNumber(line, len, sizeof(line), e.status, 0);
+      appendString(line, len, sizeof(line), " value=");
+      appendNumber(line, len, sizeof(line), e.value, 0);
+      appendString(line, len, sizeof(line), "\n");
+
+      if (!writeAll(fd, line, len))
+        return false;
+    } // for
+
+    return true;
+  } // FlightRecorder::dump
+
+  void FlightRecorder::dumpAll(const int fd) {
+    FlightRecorder *recorder;
+    unsigned int unregistered;
+    char line[96];
+    size_t len = 0;
+    size_t i;
+
+    // before reading any slot, see ~FlightRecorder
+    __sync_fetch_and_add(&s_dumping, 1);
+
+    for(i = 0; i < MAXIMUM_RECORDERS; i++) {
+      recorder = s_recorders[i];
+      if (recorder != NULL)
+        recorder->dump(fd);
+    } // for
+
+    unregistered = numUnregistered();
+    if (unregistered) {
+      appendNumber(line, len, sizeof(line), unregistered, 0);
+      appendString(line, len, sizeof(line), " more flight recorders not dumped, over the limit of ");
+      appendNumber(line, len, sizeof(line), MAXIMUM_RECORDERS, 0);
+      appendString(line, len, sizeof(line), "\n");
+      writeAll(fd, line, len);
+    } // if
+
+    __sync_fetch_and_sub(&s_dumping, 1);
+  } // FlightRecorder::dumpAll
+
+  void FlightRecorder::_signalHandler(int) {
+    const int savedErrno = errno;
+
+    dumpAll(s_signalFd);
+
+    errno = savedErrno;
+  } // FlightRecorder::_signalHandler
+
+  // e.g. dumpOnSignal(SIGUSR2, STDERR_FILENO)
+  const bool FlightRecorder::dumpOnSignal(const int signo, const int fd) {
+    struct sigaction sa;
+
+    s_signalFd = fd;
+
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = _signalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    return sigaction(signo, &sa, NULL) == 0;
+  } // FlightRecorder::dumpOnSignal
+} // namespace apns
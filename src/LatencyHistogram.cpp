@@ -0,0 +1,168 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+#include "LatencyHistogram.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** LatencyHistogram Class                                               **
+ **************************************************************************/
+  const unsigned int LatencyHistogram::SUB_BUCKET_BITS		= 6;
+  const uint64_t LatencyHistogram::MAXIMUM_VALUE		= (1ULL << 36) - 1;	// ~19 hours
+
+  LatencyHistogram::LatencyHistogram() {
+    _counts.assign(_index(MAXIMUM_VALUE) + 1, 0);
+    reset();
+
+    return;
+  } // LatencyHistogram::LatencyHistogram
+
+  LatencyHistogram::~LatencyHistogram() {
+
+    return;
+  } // LatencyHistogram::~LatencyHistogram
+
+  const uint64_t LatencyHistogram::now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  } // LatencyHistogram::now
+
+  // Values under 2^SUB_BUCKET_BITS index themselves; above that we keep
+  // the top SUB_BUCKET_BITS bits and count how far they were shifted.
+  const size_t LatencyHistogram::_index(const uint64_t value) const {
+    const unsigned int half = 1 << (SUB_BUCKET_BITS - 1);
+    unsigned int shift;
+
+    if (value < (1ULL << SUB_BUCKET_BITS))
+      return value;
+
+    shift = (63 - __builtin_clzll(value)) - (SUB_BUCKET_BITS - 1);
+
+    return shift * half + (value >> shift);
+  } // LatencyHistogram::_index
+
+  const uint64_t LatencyHistogram::_highestValue(const size_t index) const {
+    const unsigned int half = 1 << (SUB_BUCKET_BITS - 1);
+    unsigned int shift;
+
+    if (index < (1U << SUB_BUCKET_BITS))
+      return index;
+
+    shift = index / half - 1;
+
+    return ((index - shift * half + 1) << shift) - 1;
+  } // LatencyHistogram::_highestValue
+
+  void LatencyHistogram::record(const uint64_t value) {
+    const uint64_t v = value > MAXIMUM_VALUE ? MAXIMUM_VALUE : value;
+
+    _counts[_index(v)]++;
+    _count++;
+    _sum += v;
+
+    if (v < _min)
+      _min = v;
+    if (v > _max)
+      _max = v;
+  } // LatencyHistogram::record
+
+  void LatencyHistogram::merge(const LatencyHistogram &other) {
+    size_t i;
+
+    for(i = 0; i < _counts.size(); i++)
+      _counts[i] += other._counts[i];
+
+    _count += other._count;
+    _sum += other._sum;
+
+    if (other._min < _min)
+      _min = other._min;
+    if (other._max > _max)
+      _max = other._max;
+  } // LatencyHistogram::merge
+
+  void LatencyHistogram::reset() {
+    _counts.assign(_counts.size(), 0);
+    _count = 0;
+    _sum = 0;
+    _min = MAXIMUM_VALUE;
+    _max = 0;
+  } // LatencyHistogram::reset
+
+  const uint64_t LatencyHistogram::mean() const {
+    return _count ? _sum / _count : 0;
+  } // LatencyHistogram::mean
+
+  const uint64_t LatencyHistogram::percentile(const double percent) const {
+    unsigned long long target;
+    unsigned long long seen = 0;
+    uint64_t value;
+    size_t i;
+
+    if (!_count)
+      return 0;
+
+    target = (unsigned long long) (percent / 100.0 * _count + 0.5);
+    if (target < 1)
+      target = 1;
+    if (target > _count)
+      target = _count;
+
+    for(i = 0; i < _counts.size(); i++) {
+      seen += _counts[i];
+      if (seen >= target)
+        break;
+    } // for
+
+    // the bucket's top end, but never past what we actually saw
+    value = _highestValue(i);
+
+    return value > _max ? _max : value;
+  } // LatencyHistogram::percentile
+
+  const std::string LatencyHistogram::summary() const {
+    std::stringstream s;
+
+    s << "p50(" << p50()
+      << ") p99(" << p99()
+      << ") p999(" << p999()
+      << ") max(" << max()
+      << ") count(" << count()
+      << ")";
+
+    return s.str();
+  } // LatencyHistogram::summary
+} // namespace apns
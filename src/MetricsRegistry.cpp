@@ -0,0 +1,338 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "MetricsRegistry.h"
+
+namespace apns {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** MetricsRegistry Class                                                **
+ **************************************************************************/
+  static const char *s_queueNames[METRICS_QUEUE_MAX] = { "send", "stage", "error", "held" };
+
+  MetricsRegistry::MetricsRegistry() {
+    _listenFd = -1;
+
+    pthread_mutex_init(&_mutex, NULL);
+
+    return;
+  } // MetricsRegistry::MetricsRegistry
+
+  MetricsRegistry::~MetricsRegistry() {
+    if (_listenFd != -1) {
+      close(_listenFd);
+      unlink(_listenPath.c_str());
+    } // if
+
+    pthread_mutex_destroy(&_mutex);
+
+    return;
+  } // MetricsRegistry::~MetricsRegistry
+
+  void MetricsRegistry::copy(PushMetrics_t &to, const PushMetrics_t &from) {
+    size_t i;
+
+    to.framesWritten = get(from.framesWritten);
+    to.bytesWritten = get(from.bytesWritten);
+    to.connects = get(from.connects);
+    to.connectFailures = get(from.connectFailures);
+    to.disconnects = get(from.disconnects);
+    to.deadTokens = get(from.deadTokens);
+    to.rateLimited = get(from.rateLimited);
+
+    for(i = 0; i < METRICS_MAXIMUM_STATUS; i++)
+      to.errors[i] = get(from.errors[i]);
+
+    for(i = 0; i < METRICS_QUEUE_MAX; i++) {
+      to.queueDepth[i] = get(from.queueDepth[i]);
+      to.queueOldestUs[i] = get(from.queueOldestUs[i]);
+    } // for
+  } // MetricsRegistry::copy
+
+  void MetricsRegistry::add(const std::string &name, PushMetrics_t *metrics) {
+    std::pair<metricsMapType::iterator, bool> ret;
+
+    pthread_mutex_lock(&_mutex);
+    ret = _metrics.insert(std::make_pair(name, metrics));
+    pthread_mutex_unlock(&_mutex);
+
+    if (!ret.second)
+      throw MetricsRegistry_Exception("Metrics for " + name + " already registered.");
+  } // MetricsRegistry::add
+
+  void MetricsRegistry::remove(const PushMetrics_t *metrics) {
+    metricsMapType::iterator ptr;
+
+    pthread_mutex_lock(&_mutex);
+    for(ptr = _metrics.begin(); ptr != _metrics.end(); ptr++) {
+      if (ptr->second == metrics) {
+        _metrics.erase(ptr);
+        break;
+      } // if
+    } // for
+    pthread_mutex_unlock(&_mutex);
+  } // MetricsRegistry::remove
+
+  const size_t MetricsRegistry::size() {
+    size_t ret;
+
+    pthread_mutex_lock(&_mutex);
+    ret = _metrics.size();
+    pthread_mutex_unlock(&_mutex);
+
+    return ret;
+  } // MetricsRegistry::size
+
+  // Holding the lock keeps a controller from going away mid copy; the
+  // controllers themselves carry on updating while we read.
+  const size_t MetricsRegistry::snapshot(snapshotVectorType &snapshots) {
+    metricsMapType::iterator ptr;
+    PushMetrics_t metrics;
+
+    snapshots.clear();
+
+    pthread_mutex_lock(&_mutex);
+    snapshots.reserve(_metrics.size());
+    for(ptr = _metrics.begin(); ptr != _metrics.end(); ptr++) {
+      copy(metrics, *ptr->second);
+      snapshots.push_back(std::make_pair(ptr->first, metrics));
+    } // for
+    pthread_mutex_unlock(&_mutex);
+
+    return snapshots.size();
+  } // MetricsRegistry::snapshot
+
+  const std::string MetricsRegistry::_escape(const std::string &value) {
+    std::string ret;
+    size_t i;
+
+    for(i = 0; i < value.length(); i++) {
+      if (value[i] == '\\' || value[i] == '"')
+        ret += '\\';
+
+      if (value[i] == '\n')
+        ret += "\\n";
+      else
+        ret += value[i];
+    } // for
+
+    return ret;
+  } // MetricsRegistry::_escape
+
+  void MetricsRegistry::_counter(std::stringstream &s, const char *name, const char *help,
+                                 const snapshotVectorType &snapshots,
+                                 unsigned long long PushMetrics_t::*field) {
+    size_t i;
+
+    s << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " counter\n";
+
+    for(i = 0; i < snapshots.size(); i++)
+      s << name << "{controller=\"" << _escape(snapshots[i].first) << "\"} "
+        << snapshots[i].second.*field << "\n";
+  } // MetricsRegistry::_counter
+
+  const std::string MetricsRegistry::prometheus() {
+    snapshotVectorType snapshots;
+    std::stringstream s;
+    std::string label;
+    char seconds[32];
+    size_t i;
+    size_t j;
+
+    snapshot(snapshots);
+
+    _counter(s, "apns_frames_written_total", "Frames completely written to the gateway.", snapshots, &PushMetrics_t::framesWritten);
+    _counter(s, "apns_bytes_written_total", "Bytes written to the gateway.", snapshots, &PushMetrics_t::bytesWritten);
+    _counter(s, "apns_connects_total", "Connections established.", snapshots, &PushMetrics_t::connects);
+    _counter(s, "apns_connect_failures_total", "Connect attempts given up on.", snapshots, &PushMetrics_t::connectFailures);
+    _counter(s, "apns_disconnects_total", "Connections dropped after an error or a dead peer.", snapshots, &PushMetrics_t::disconnects);
+    _counter(s, "apns_dead_token_refused_total", "Messages refused for dead tokens.", snapshots, &PushMetrics_t::deadTokens);
+    _counter(s, "apns_rate_limited_total", "Messages over their token's rate limit.", snapshots, &PushMetrics_t::rateLimited);
+
+    s << "# HELP apns_error_responses_total Error responses by status.\n"
+      << "# TYPE apns_error_responses_total counter\n";
+    for(i = 0; i < snapshots.size(); i++) {
+      label = "controller=\"" + _escape(snapshots[i].first) + "\"";
+
+      for(j = 0; j < METRICS_MAXIMUM_STATUS; j++) {
+        if (snapshots[i].second.errors[j])
+          s << "apns_error_responses_total{" << label << ",status=\"" << j << "\"} "
+            << snapshots[i].second.errors[j] << "\n";
+      } // for
+    } // for
+
+    s << "# HELP apns_queue_depth Messages in each queue.\n"
+      << "# TYPE apns_queue_depth gauge\n";
+    for(i = 0; i < snapshots.size(); i++) {
+      label = "controller=\"" + _escape(snapshots[i].first) + "\"";
+
+      for(j = 0; j < METRICS_QUEUE_MAX; j++)
+        s << "apns_queue_depth{" << label << ",queue=\"" << s_queueNames[j] << "\"} "
+          << snapshots[i].second.queueDepth[j] << "\n";
+    } // for
+
+    s << "# HELP apns_queue_oldest_seconds Age of the oldest message in each queue.\n"
+      << "# TYPE apns_queue_oldest_seconds gauge\n";
+    for(i = 0; i < snapshots.size(); i++) {
+      label = "controller=\"" + _escape(snapshots[i].first) + "\"";
+
+      for(j = 0; j < METRICS_QUEUE_MAX; j++) {
+        snprintf(seconds, sizeof(seconds), "%llu.%06llu",
+                 snapshots[i].second.queueOldestUs[j] / 1000000,
+                 snapshots[i].second.queueOldestUs[j] % 1000000);
+        s << "apns_queue_oldest_seconds{" << label << ",queue=\"" << s_queueNames[j] << "\"} "
+          << seconds << "\n";
+      } // for
+    } // for
+
+    return s.str();
+  } // MetricsRegistry::prometheus
+
+  // Written aside and renamed so a collector never reads half a file.
+  const bool MetricsRegistry::writeFile(const std::string &path) {
+    const std::string tmpPath = path + ".tmp";
+    const std::string text = prometheus();
+    std::ofstream out;
+
+    out.open(tmpPath.c_str(), std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+      APNS_LOG(LogWarn, << "Unable to write metrics to "
+                        << tmpPath
+                        << std::endl);
+      return false;
+    } // if
+
+    out << text;
+    out.close();
+
+    if (out.fail() || rename(tmpPath.c_str(), path.c_str()) == -1) {
+      APNS_LOG(LogWarn, << "Unable to write metrics to "
+                        << path
+                        << std::endl);
+      unlink(tmpPath.c_str());
+      return false;
+    } // if
+
+    return true;
+  } // MetricsRegistry::writeFile
+
+  const bool MetricsRegistry::listen(const std::string &path) {
+    struct sockaddr_un addr;
+    int ofcmode;
+
+    if (_listenFd != -1)
+      throw MetricsRegistry_Exception("Metrics socket already listening on " + _listenPath + ".");
+
+    if (path.length() >= sizeof(addr.sun_path))
+      throw MetricsRegistry_Exception("Metrics socket path too long.");
+
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listenFd == -1)
+      return false;
+
+    ofcmode = fcntl(_listenFd, F_GETFL, 0);
+    fcntl(_listenFd, F_SETFL, ofcmode | O_NONBLOCK);
+
+    // a socket left behind by a previous run
+    unlink(path.c_str());
+
+    if (bind(_listenFd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || ::listen(_listenFd, 8) == -1) {
+      APNS_LOG(LogWarn, << "Unable to listen for metrics on "
+                        << path
+                        << ": "
+                        << strerror(errno)
+                        << std::endl);
+      close(_listenFd);
+      _listenFd = -1;
+      return false;
+    } // if
+
+    _listenPath = path;
+
+    return true;
+  } // MetricsRegistry::listen
+
+  // Waits up to msec for someone to connect, then answers everyone
+  // waiting; returns how many were answered.
+  const unsigned int MetricsRegistry::serve(const int msec) {
+    struct pollfd pfd;
+    std::string text;
+    unsigned int numServed = 0;
+    ssize_t ret;
+    size_t offset;
+    int fd;
+
+    if (_listenFd == -1)
+      return 0;
+
+    pfd.fd = _listenFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, msec) < 1)
+      return 0;
+
+    while((fd = accept(_listenFd, NULL, NULL)) != -1) {
+      // accepted sockets don't inherit O_NONBLOCK on Linux; the text is
+      // small enough to sit in a local socket buffer
+      if (text.empty())
+        text = prometheus();
+
+      for(offset = 0; offset < text.length(); offset += ret) {
+        ret = send(fd, text.data() + offset, text.length() - offset, MSG_NOSIGNAL);
+        if (ret < 1)
+          break;
+      } // for
+
+      close(fd);
+      numServed++;
+    } // while
+
+    return numServed;
+  } // MetricsRegistry::serve
+} // namespace apns
@@ -53,6 +53,8 @@
 
 #include "ApnsMessage.h"
 #include "PushController.h"
+#include "DeadTokenFilter.h"
+#include "TokenRateLimiter.h"
 
 namespace apns {
   using namespace openframe::loglevel;
@@ -61,9 +63,21 @@ namespace apns {
  ** APNS Class                                                           **
  **************************************************************************/
   const time_t PushController::CONNECT_RETRY_TIMEOUT 	= 60;
+  const time_t PushController::CONNECT_RETRY_MINIMUM 	= 1;
   const time_t PushController::DEFAULT_STATS_INTERVAL 	= 3600;
   const int PushController::ERROR_RESPONSE_SIZE 	= 6;
   const int PushController::ERROR_RESPONSE_COMMAND 	= 8;
+  const size_t PushController::DEFAULT_MAXIMUM_PAYLOAD_SIZE 	= 256;
+  const size_t PushController::PROTOCOL_MAXIMUM_PAYLOAD_SIZE 	= 65535;	// uint16_t length field
+  const size_t PushController::DEFAULT_WRITE_BUFFER_SIZE 	= 65536;
+  const size_t PushController::MINIMUM_BATCH_SIZE 	= 4096;
+  const time_t PushController::DEFAULT_DEAD_PEER_TIMEOUT 	= 15;
+  const time_t PushController::RESPONSE_WINDOW 	= 30;
+  const time_t PushController::DEFAULT_DRAIN_TIMEOUT 	= 5;
+  const time_t PushController::DEFAULT_DRAIN_LINGER 	= 1;
+  const int PushController::DRAIN_POLL_INTERVAL 	= 10;		// milliseconds
+  const unsigned int PushController::DEFAULT_LOG_SAMPLE_RATE 	= 100;
+  const size_t PushController::DEFAULT_MAXIMUM_HELD 	= 10000;
 
   PushController::PushController(const std::string &host, const int port, const std::string &certfile, const std::string &keyfile, const std::string &capath, const time_t timeout) :
     SslController(host, port, certfile, keyfile, capath), _timeout(timeout) {
@@ -73,115 +87,680 @@ namespace apns {
     _logStatsTs = time(NULL) + _logStatsInterval;
     _lastActivityTs = time(NULL);
     _connectRetryTimeout = CONNECT_RETRY_TIMEOUT;
+    _connectRetryMinimum = CONNECT_RETRY_MINIMUM;
+    _connectRetryTs = 0;
+    _connectFailures = 0;
+    _maxPayloadSize = DEFAULT_MAXIMUM_PAYLOAD_SIZE;
+    _writeBufferSize = DEFAULT_WRITE_BUFFER_SIZE;
+    _batchBytes = DEFAULT_WRITE_BUFFER_SIZE;
+    _adaptiveBatching = true;
+    _deadPeerTimeout = DEFAULT_DEAD_PEER_TIMEOUT;
+    _livenessCheckTs = 0;
+    _lastAckTs = 0;
+    _ackedFrames = 0;
+    _writtenFramesEnd = 0;
+    _drainTimeout = DEFAULT_DRAIN_TIMEOUT;
+    _drainLinger = DEFAULT_DRAIN_LINGER;
+    _closingTs = 0;
+    _draining = false;
+    _deadTokenFilter = NULL;
+    _rateLimiter = NULL;
+    _overLimitPolicy = OVERLIMIT_DROP;
+    _maximumHeld = DEFAULT_MAXIMUM_HELD;
+    _releaseHeldTs = 0;
+    _numRateDropped = 0;
+    _numRateDelayed = 0;
+    _numRateCollapsed = 0;
 
     _numStatsError = 0;
     _numStatsSent = 0;
     _numStatsDisconnected = 0;
+    _numStatsDeadTokens = 0;
+    _numStatsRateLimited = 0;
+
+    memset(&_metrics, '\0', sizeof(_metrics));
+    _metricsRegistry = NULL;
+    _queueAgeTs = 0;
+    _outcomeHandler = NULL;
+    _logSampleRate = DEFAULT_LOG_SAMPLE_RATE;
+    _logSampleCount = 0;
 
     return;
   } // PushController::PushController
 
   PushController::~PushController() {
+    messageQueueType unsent;
+
+    // give what we already wrote a chance to be rejected properly and
+    // what is still queued a chance to go out before we let go of it
+    if (_drainTimeout && (isConnected() || isConnecting() || !_messageSendQueue.empty()))
+      drain(time(NULL) + _drainTimeout, unsent);
+
+    _clearHeldMessages(unsent);
+    _clearMessagesFromQueue(unsent);
+    _pendingFrames.clear();
+    _inflightFrames.clear();
     _clearMessagesFromQueue(_messageSendQueue);
     _clearMessagesFromQueue(_messageStageQueue);
     _clearMessagesFromQueue(_messageErrorQueue);
+    _deliverOutcomes();
 
-    if (isConnected())
+    if (isConnected() || isConnecting())
       disconnect();
 
+    if (_metricsRegistry != NULL)
+      _metricsRegistry->remove(&_metrics);
+
     return;
   } // PushController::~PushController
 
+  void PushController::metricsRegistry(MetricsRegistry *metricsRegistry, const std::string &name) {
+    if (_metricsRegistry != NULL)
+      _metricsRegistry->remove(&_metrics);
+
+    _metricsRegistry = metricsRegistry;
+
+    if (_metricsRegistry != NULL)
+      _metricsRegistry->add(name, &_metrics);
+  } // PushController::metricsRegistry
+
   const bool PushController::run() {
     unsigned int numRows;
 
-    if (time(NULL) < _connectRetryTs)
-      return false;
-
     if (time(NULL) > _logStatsTs)
       _logStats();
 
+    _releaseHeldMessages();
     _processMessageSendQueue();
+    _checkPeerLiveness();
+    _pruneInflightFrames();
     _expireIdleConnection();
+    _updateQueueGauges();
+
+    // a frame that keeps being put back must not outlive its expiry
+    if ((numRows = _removeExpiredMessagesFromQueue(_messageSendQueue)) > 0)
+      APNS_LOG(LogNotice, << "Expired "
+                          << numRows
+                          << " message"
+                          << (numRows == 1 ? "" : "s")
+                          << " from send queue."
+                          << std::endl);
 
     if ((numRows = _removeExpiredMessagesFromQueue(_messageStageQueue)) > 0)
-      LOG(LogNotice, << "Expired "
-                     << numRows
-                     << " message"
-                     << (numRows == 1 ? "" : "s")
-                     << " from stage queue."
-                     << std::endl);
+      APNS_LOG(LogNotice, << "Expired "
+                          << numRows
+                          << " message"
+                          << (numRows == 1 ? "" : "s")
+                          << " from stage queue."
+                          << std::endl);
 
     if ((numRows =_removeExpiredMessagesFromQueue(_messageErrorQueue)) > 0)
-      LOG(LogNotice, << "Expired "
-                     << numRows
-                     << " message"
-                     << (numRows == 1 ? "" : "s")
-                     << " from error queue."
-                     << std::endl);
+      APNS_LOG(LogNotice, << "Expired "
+                          << numRows
+                          << " message"
+                          << (numRows == 1 ? "" : "s")
+                          << " from error queue."
+                          << std::endl);
+
+    _deliverOutcomes();
 
     return true;
   } // PushController::run
 
   void PushController::_processMessageSendQueue() {
-    messageQueueType::iterator ptr;		// message queue iterator
+    ApnsMessage *aMessage;			// message being framed
     messageQueueType processQueue;		// local queue storage for processing
-    unsigned int id;
+    unsigned int id = 0;
+    size_t budget;
+    bool errorResponse = false;
     int numBytes;
 
-    if (_messageSendQueue.empty())
+    // frames that never made it out of a dead connection go first
+    _requeueUnwrittenFrames(true);
+
+    if (_messageSendQueue.empty() && !pendingBytes())
       return;
 
-    if (!isConnected() && !connect()) {
-      LOG(LogWarn, << "WARNING: Messages ("
-                   << _messageSendQueue.size()
-                   << ") ready to send but unable connect, will retry in "
-                   << _connectRetryTimeout
-                   << " seconds."
-                   << std::endl);
-      _connectRetryTs = time(NULL) + _connectRetryTimeout;
+    // backing off after a failed connect
+    if (!isConnected() && !isConnecting() && time(NULL) < _connectRetryTs)
       return;
+
+    if (!isConnected()) {
+      if (!connect()) {
+        // still resolving, connecting or handshaking; pick it back up
+        // on the next run() instead of waiting on it here
+        if (isConnecting())
+          return;
+
+        _scheduleReconnect();
+        return;
+      } // if
+
+      MetricsRegistry::increment(_metrics.connects, 1);
     } // if
 
-    LOG(LogInfo, << "INFO: Sending message queue: "
-                 << _messageSendQueue.size()
-                 << " message(s) left in queue."
-                 << std::endl);
+    _connectFailures = 0;
+
+    APNS_LOG(LogInfo, << "INFO: Sending message queue: "
+                      << _messageSendQueue.size()
+                      << " message(s) left in queue."
+                      << std::endl);
 
     // We don't want to edit the real queue so that
     // the sending queue can put failed messages back into
     // the send queue.
     processQueue = _messageSendQueue;
-    while(!processQueue.empty() && isConnected()) {
-      ptr = processQueue.begin();
+    while(isConnected()) {
+      // Frame messages into the output buffer until it holds enough
+      // to keep the socket busy.
+      budget = _batchBudget();
+      while(!processQueue.empty() && pendingBytes() < budget) {
+        aMessage = *processQueue.begin();
+
+        _messageStageQueue.insert(aMessage);
+        _messageSendQueue.erase(aMessage);
+        processQueue.erase(aMessage);
+        id = aMessage->id();
+
+        _sendPayload(aMessage);
+      } // while
+
+      if (flush() < 0) {
+        // APNs hangs up right after an error response, so a failed write
+        // may be the first we hear of it; the response is still readable.
+        // Whatever this flush got out goes in flight first, the frame it
+        // names may be among them.
+        _completeWrittenFrames();
+        if (_readResponseFromApns() > 0) {
+          errorResponse = true;
+          _numStatsDisconnected++;
+          MetricsRegistry::increment(_metrics.disconnects, 1);
+          _numStatsError++;
+        } // if
+        break;
+      } // if
 
-      _messageStageQueue.insert(*ptr);
-      _messageSendQueue.erase(*ptr);
-      processQueue.erase(*ptr);
-      id = (*ptr)->id();
+      _completeWrittenFrames();
 
-      _sendPayload(*ptr);
       if ((numBytes = _readResponseFromApns()) > 0) {
-        LOG(LogNotice, << "Detected a response with "
-                       << numBytes
-                       << " bytes to [custom identifier: "
-                       << id
-                       << "] deferring "
-                       << _messageSendQueue.size()
-                       << " queued for reconnect."
-                       << std::endl);
-        // On error, we will get disconnected
+        APNS_LOG(LogNotice, << "Detected a response with "
+                            << numBytes
+                            << " bytes to [custom identifier: "
+                            << id
+                            << "] deferring "
+                            << _messageSendQueue.size()
+                            << " queued for reconnect."
+                            << std::endl);
+        // On error, we will get disconnected; that says nothing about
+        // the path so reconnect right away rather than back off.
+        errorResponse = true;
         disconnect();
         _numStatsDisconnected++;
+        MetricsRegistry::increment(_metrics.disconnects, 1);
         _numStatsError++;
-        //break;
+        break;
       } // if
+
+      // Socket is full or the kernel already holds enough, come back
+      // when it drains rather than spin.
+      if (pendingBytes() || processQueue.empty() || !budget)
+        break;
     } // while
 
+    if (!isConnected()) {
+      // The socket failed under us (reset, TCP_USER_TIMEOUT...) so what
+      // it had not acked is as good as lost; an error response is APNs
+      // telling us exactly what it dropped instead.
+      if (!errorResponse)
+        _requeueInflightFrames();
+      _requeueUnwrittenFrames(true);
+    } // if
+
     return;
   } // _processMessageQueue
 
+  // Each failed connect doubles the wait, starting at the minimum and
+  // capped at the retry timeout; the actual wait is drawn from the upper
+  // half of that so a fleet that lost APNs together does not come back
+  // in lock step.
+  void PushController::_scheduleReconnect() {
+    time_t delay = _connectRetryMinimum > 0 ? _connectRetryMinimum : 1;
+    unsigned int i;
+
+    for(i = 0; i < _connectFailures && delay < _connectRetryTimeout; i++)
+      delay *= 2;
+
+    if (delay > _connectRetryTimeout)
+      delay = _connectRetryTimeout;
+
+    delay = delay / 2 + rand() % (delay - delay / 2 + 1);
+    if (delay < _connectRetryMinimum)
+      delay = _connectRetryMinimum;
+
+    _connectFailures++;
+    _connectRetryTs = time(NULL) + delay;
+    MetricsRegistry::increment(_metrics.connectFailures, 1);
+
+    APNS_LOG(LogWarn, << "WARNING: Messages ("
+                      << _messageSendQueue.size()
+                      << ") ready to send but unable connect, will retry in "
+                      << delay
+                      << " seconds (attempt "
+                      << _connectFailures
+                      << ")."
+                      << std::endl);
+  } // PushController::_scheduleReconnect
+
+  // With data outstanding and no ack from the peer in deadPeerTimeout
+  // seconds the path is gone even though writes still land in the
+  // kernel; tear down and send again rather than wait for idle expiry.
+  // The binary protocol has no no-op frame to probe with, so idle
+  // connections are left to TCP keepalive (SocketOptions).
+  void PushController::_checkPeerLiveness() {
+    const SocketSample &sample = socketSample();
+    time_t now = time(NULL);
+
+    if (!_deadPeerTimeout || !isConnected() || now == _livenessCheckTs)
+      return;
+
+    _livenessCheckTs = now;
+
+    if (!sampleSocket())
+      return;
+
+    _noteAcks();
+
+    if (!sample.sendQueue || sample.lastAckRecv < _deadPeerTimeout * 1000)
+      return;
+
+    // lastAckRecv also counts time spent idle, the stall only starts
+    // with the oldest write the peer hasn't acked
+    if (_ackedFrames >= _inflightFrames.size()
+        || now - _inflightFrames[_ackedFrames].first < _deadPeerTimeout)
+      return;
+
+    APNS_LOG(LogWarn, << "Peer stopped acknowledging ("
+                      << sample.sendQueue
+                      << " bytes outstanding, last ack "
+                      << sample.lastAckRecv
+                      << "ms ago), dropping connection."
+                      << std::endl);
+
+    flightRecorder().record(FLIGHT_DEAD_PEER, sample.sendQueue);
+
+    _requeueInflightFrames();
+    disconnect();
+    _numStatsDisconnected++;
+    MetricsRegistry::increment(_metrics.disconnects, 1);
+    _requeueUnwrittenFrames(true);
+  } // PushController::_checkPeerLiveness
+
+  // Called after every successful socket sample: an empty kernel send
+  // queue means every frame written so far has been acked.
+  void PushController::_noteAcks() {
+    const SocketSample &sample = socketSample();
+
+    _lastAckTs = time(NULL) - sample.lastAckRecv / 1000;
+
+    if (sample.sendQueue)
+      return;
+
+    // only frames still staged are safe to look at
+    for(; _ackedFrames < _inflightFrames.size(); _ackedFrames++) {
+      ApnsMessage *aMessage = _inflightFrames[_ackedFrames].second;
+
+      if (_messageStageQueue.count(aMessage))
+        _confirmLatency.recordSince(aMessage->_writtenUs);
+    } // for
+  } // PushController::_noteAcks
+
+  // APNs answers a bad frame within moments of reading it, so frames
+  // older than the response window (or than the dead peer timeout allows
+  // for an unacked write) no longer need their place in the order.
+  void PushController::_pruneInflightFrames() {
+    time_t horizon = time(NULL) - RESPONSE_WINDOW;
+
+    if (time(NULL) - 2 * _deadPeerTimeout < horizon)
+      horizon = time(NULL) - 2 * _deadPeerTimeout;
+
+    while(!_inflightFrames.empty() && _inflightFrames.front().first < horizon) {
+      // APNs had its chance to object
+      if (_messageStageQueue.count(_inflightFrames.front().second))
+        _noteOutcome(_inflightFrames.front().second, OUTCOME_SENT, ERR_NO_ERRORS);
+
+      _inflightFrames.pop_front();
+
+      if (_ackedFrames)
+        _ackedFrames--;
+    } // while
+  } // PushController::_pruneInflightFrames
+
+  // Frames handed to the kernel since the peer's last ack go back to the
+  // send queue; ones written before it were most likely delivered.  Each
+  // one put back is charged a retry, so a frame that keeps going down
+  // with its connection is given up on rather than resent forever.
+  const unsigned int PushController::_requeueInflightFrames() {
+    unsigned int numRows = 0;
+    ApnsMessage *aMessage;
+
+    while(!_inflightFrames.empty()) {
+      aMessage = _inflightFrames.front().second;
+
+      if (_ackedFrames)
+        _ackedFrames--;
+      else if (_inflightFrames.front().first >= _lastAckTs
+               && _messageStageQueue.erase(aMessage)) {
+        aMessage->retry();
+        _messageSendQueue.insert(aMessage);
+        numRows++;
+      } // else if
+
+      _inflightFrames.pop_front();
+    } // while
+
+    if (numRows) {
+      flightRecorder().record(FLIGHT_REQUEUED, numRows);
+      APNS_LOG(LogNotice, << "Requeued "
+                          << numRows
+                          << " unacknowledged message"
+                          << (numRows == 1 ? "" : "s")
+                          << " after losing the connection."
+                          << std::endl);
+    } // if
+
+    return numRows;
+  } // PushController::_requeueInflightFrames
+
+  // How many bytes to frame this round. Enough to cover roughly two
+  // congestion windows in flight, less what the kernel is still sitting
+  // on, so we neither flood the send queue (and the replay after an
+  // error frame) nor leave the pipe empty.
+  const size_t PushController::_batchBudget() {
+    const SocketSample &sample = socketSample();
+    size_t target;
+    size_t queued;
+
+    if (!_adaptiveBatching || !sampleSocket()) {
+      _batchBytes = _writeBufferSize;
+      return _batchBytes;
+    } // if
+
+    _noteAcks();
+
+    if (!sample.mss) {
+      _batchBytes = _writeBufferSize;
+      return _batchBytes;
+    } // if
+
+    target = 2 * (size_t) sample.cwnd * sample.mss;
+    if (target < MINIMUM_BATCH_SIZE)
+      target = MINIMUM_BATCH_SIZE;
+    if (target > _writeBufferSize)
+      target = _writeBufferSize;
+
+    queued = sample.sendQueue > 0 ? sample.sendQueue : 0;
+    _batchBytes = target > queued ? target - queued : 0;
+
+    return _batchBytes;
+  } // PushController::_batchBudget
+
+  // Every frame that ends at or before the number of bytes SSL_write
+  // has accepted is on the wire in full.
+  void PushController::_completeWrittenFrames() {
+    const uint64_t now = LatencyHistogram::now();
+    ApnsMessage *aMessage;
+
+    while(!_pendingFrames.empty() && _pendingFrames.front().first <= bytesFlushed()) {
+      aMessage = _pendingFrames.front().second;
+      aMessage->_writtenUs = now;
+      _queueLatency.record(now - aMessage->_queuedUs);
+
+      _inflightFrames.push_back(std::make_pair(time(NULL), aMessage));
+      _writtenFramesEnd = _pendingFrames.front().first;
+      _pendingFrames.pop_front();
+      _numStatsSent++;
+      MetricsRegistry::increment(_metrics.framesWritten, 1);
+    } // while
+
+    MetricsRegistry::set(_metrics.bytesWritten, bytesFlushed());
+  } // PushController::_completeWrittenFrames
+
+  // Once the connection is gone, frames that were not completely written
+  // (including one cut off mid-frame) go back to the send queue to be
+  // sent whole on the next connection.  Only the one cut off reached the
+  // peer, so it alone is charged a retry, and only when the connection
+  // was lost rather than closed by us.
+  const unsigned int PushController::_requeueUnwrittenFrames(const bool lost) {
+    unsigned int numRows = 0;
+    ApnsMessage *cutOff = NULL;
+    ApnsMessage *aMessage;
+
+    if (isConnected())
+      return 0;
+
+    if (lost && bytesFlushed() > _writtenFramesEnd && !_pendingFrames.empty())
+      cutOff = _pendingFrames.front().second;
+    // the next connection's first frame starts where this one stopped
+    _writtenFramesEnd = bytesFlushed();
+
+    // whatever was worth replaying from the last connection already was
+    _inflightFrames.clear();
+    _ackedFrames = 0;
+
+    while(!_pendingFrames.empty()) {
+      aMessage = _pendingFrames.front().second;
+      _pendingFrames.pop_front();
+
+      // may have already been moved to the error queue by a response
+      if (_messageStageQueue.erase(aMessage) == 0)
+        continue;
+
+      if (aMessage == cutOff)
+        aMessage->retry();
+      _messageSendQueue.insert(aMessage);
+      numRows++;
+    } // while
+
+    if (numRows) {
+      flightRecorder().record(FLIGHT_REQUEUED, numRows);
+      APNS_LOG(LogNotice, << "Requeued "
+                          << numRows
+                          << " unwritten message"
+                          << (numRows == 1 ? "" : "s")
+                          << " after disconnect."
+                          << std::endl);
+    } // if
+
+    return numRows;
+  } // PushController::_requeueUnwrittenFrames
+
+  // One pass over both frame queues dropping the frames of messages
+  // about to be deleted, however many of them there are.
+  void PushController::_forgetFrames(const messageQueueType &messages) {
+    pendingFrameQueueType::iterator ptr;
+    pendingFrameQueueType::iterator keep;
+    inflightFrameQueueType::iterator iptr;
+    inflightFrameQueueType::iterator ikeep;
+    size_t ackedFrames = _ackedFrames;
+    size_t i;
+
+    if (messages.empty())
+      return;
+
+    keep = _pendingFrames.begin();
+    for(ptr = _pendingFrames.begin(); ptr != _pendingFrames.end(); ptr++) {
+      if (!messages.count(ptr->second))
+        *keep++ = *ptr;
+    } // for
+    _pendingFrames.erase(keep, _pendingFrames.end());
+
+    ikeep = _inflightFrames.begin();
+    for(i = 0, iptr = _inflightFrames.begin(); iptr != _inflightFrames.end(); i++, iptr++) {
+      if (!messages.count(iptr->second)) {
+        *ikeep++ = *iptr;
+        continue;
+      } // if
+
+      if (i < _ackedFrames)
+        ackedFrames--;
+    } // for
+    _inflightFrames.erase(ikeep, _inflightFrames.end());
+
+    _ackedFrames = ackedFrames;
+  } // PushController::_forgetFrames
+
+  // APNs drops every frame that followed a rejected one on the floor, so
+  // those go back to the send queue in the order they were written, with
+  // what is still buffered for the connection the response closes.  None
+  // of them is charged a retry, they were never looked at.
+  const unsigned int PushController::_requeueFramesAfter(ApnsMessage *aMessage) {
+    inflightFrameQueueType::iterator ptr;
+    unsigned int numRows = 0;
+
+    for(ptr = _inflightFrames.begin(); ptr != _inflightFrames.end(); ptr++) {
+      if (ptr->second == aMessage)
+        break;
+    } // for
+
+    for(; !_pendingFrames.empty(); _pendingFrames.pop_front()) {
+      if (_messageStageQueue.erase(_pendingFrames.front().second) == 0)
+        continue;
+
+      _messageSendQueue.insert(_pendingFrames.front().second);
+      numRows++;
+    } // for
+
+    if (ptr != _inflightFrames.end()) {
+      for(ptr++; ptr != _inflightFrames.end(); ptr++) {
+        if (_messageStageQueue.erase(ptr->second) == 0)
+          continue;
+
+        _messageSendQueue.insert(ptr->second);
+        numRows++;
+      } // for
+
+      _inflightFrames.clear();
+      _ackedFrames = 0;
+    } // if
+
+    if (numRows) {
+      flightRecorder().record(FLIGHT_REQUEUED, numRows);
+      APNS_LOG(LogNotice, << "Requeued "
+                          << numRows
+                          << " message"
+                          << (numRows == 1 ? "" : "s")
+                          << " written after [custom identifier: "
+                          << aMessage->id()
+                          << "]."
+                          << std::endl);
+    } // if
+
+    return numRows;
+  } // PushController::_requeueFramesAfter
+
+  // Wait until the given time for APNs to reject something we wrote,
+  // trying at least once; true if it did and the connection is closed.
+  const bool PushController::_lingerForResponses(const time_t until) {
+    do {
+      waitForSocket(DRAIN_POLL_INTERVAL);
+
+      if (_readResponseFromApns() > 0) {
+        disconnect();
+        _numStatsDisconnected++;
+        MetricsRegistry::increment(_metrics.disconnects, 1);
+        _numStatsError++;
+        return true;
+      } // if
+    } while(isConnected() && time(NULL) < until);
+
+    return false;
+  } // PushController::_lingerForResponses
+
+  // Push out what is queued and linger for error responses until the
+  // deadline, then hang up; whatever is left goes back to the send queue.
+  void PushController::_drainConnection(const time_t deadline) {
+    time_t lingerUntil;
+
+    while(time(NULL) < deadline) {
+      if (!_messageSendQueue.empty() || pendingBytes()) {
+        _processMessageSendQueue();
+
+        if (isConnected() || isConnecting()) {
+          waitForSocket(DRAIN_POLL_INTERVAL);
+          continue;
+        } // if
+
+        // unable to connect, nothing more we can do before the deadline
+        if (_connectRetryTs > time(NULL))
+          break;
+
+        continue;
+      } // if
+
+      if (!isConnected())
+        break;
+
+      lingerUntil = time(NULL) + _drainLinger;
+      if (lingerUntil > deadline)
+        lingerUntil = deadline;
+
+      // quiet for the linger period, everything we wrote stands
+      if (!_lingerForResponses(lingerUntil))
+        break;
+    } // while
+
+    if (isConnected() || isConnecting())
+      disconnect();
+
+    _requeueUnwrittenFrames(false);
+  } // PushController::_drainConnection
+
+  // Stop taking messages, push out what is queued and give APNs until the
+  // deadline to reject any of it; whatever could not be sent by then is
+  // handed back to the caller, who owns it from here on.
+  const unsigned int PushController::drain(const time_t deadline, messageQueueType &unsent) {
+    messageQueueType::iterator ptr;
+    unsigned int numRows;
+
+    _draining = true;
+    _connectRetryTs = 0;
+
+    APNS_LOG(LogNotice, << "Draining "
+                        << _messageSendQueue.size()
+                        << " queued message(s), "
+                        << (deadline > time(NULL) ? deadline - time(NULL) : 0)
+                        << " seconds left."
+                        << std::endl);
+
+    _drainConnection(deadline);
+
+    numRows = _messageSendQueue.size();
+    for(ptr = _messageSendQueue.begin(); ptr != _messageSendQueue.end(); ptr++)
+      unsent.insert(*ptr);
+    _messageSendQueue.clear();
+
+    // held back by the rate limiter, never got the chance
+    numRows += _clearHeldMessages(unsent);
+    flightRecorder().record(FLIGHT_DRAINED, numRows);
+
+    APNS_LOG(LogNotice, << "Drained, "
+                        << numRows
+                        << " message"
+                        << (numRows == 1 ? "" : "s")
+                        << " left unsent."
+                        << std::endl);
+
+    _deliverOutcomes();
+
+    return numRows;
+  } // PushController::drain
+
   void PushController::_expireIdleConnection() {
+    if (_closingTs) {
+      _closeIdleConnection();
+      return;
+    } // if
+
     if (!_timeout || !isConnected())
       // Don't expire if timeout is 0
       return;
@@ -190,14 +769,40 @@ namespace apns {
       // not time to expire yet
       return;
 
-    LOG(LogNotice, << "Connection expired after "
-                   << _timeout
-                   << " seconds."
-                   << std::endl);
+    APNS_LOG(LogNotice, << "Connection expired after "
+                        << _timeout
+                        << " seconds."
+                        << std::endl);
+
+    // Give APNs the linger period to reject what is in flight before we
+    // hang up, checking on later run()s rather than waiting here; a
+    // shared loop has other controllers to serve meanwhile.
+    flightRecorder().record(FLIGHT_IDLE_EXPIRED, time(NULL) - _lastActivityTs);
+    _closingTs = time(NULL) + _drainLinger;
+    _closeIdleConnection();
+  } // PushController::_expireIdleConnection
+
+  // One look for an error response on an expired connection; hangs up on
+  // one or once the linger is over.  Anything written meanwhile means it
+  // is not idle after all and stays open.
+  void PushController::_closeIdleConnection() {
+    if (!isConnected() || time(NULL) < (_lastActivityTs+_timeout)) {
+      _closingTs = 0;
+      return;
+    } // if
 
-    // connection is expired, disconnect for now.
+    if (_readResponseFromApns() > 0) {
+      _numStatsDisconnected++;
+      MetricsRegistry::increment(_metrics.disconnects, 1);
+      _numStatsError++;
+    } // if
+    else if (time(NULL) < _closingTs)
+      return;
+
+    _closingTs = 0;
     disconnect();
-  } // PushController::_expireIdleConnection
+    _requeueUnwrittenFrames(false);
+  } // PushController::_closeIdleConnection
 
   const int PushController::_readResponseFromApns() {
     ApnsResponse_t r;
@@ -210,10 +815,10 @@ namespace apns {
     if (ret < 1)
       return -1;
 
-    LOG(LogInfo, << "Received response from APNS that was "
-                 << ret
-                 << " bytes."
-                 << std::endl);
+    APNS_LOG(LogInfo, << "Received response from APNS that was "
+                      << ret
+                      << " bytes."
+                      << std::endl);
 
     memcpy(&r.command, ptr++, sizeof(uint8_t));
     memcpy(&r.status, ptr++, sizeof(uint8_t));
@@ -236,129 +841,337 @@ namespace apns {
     status = r->status;
     identifier = ntohl(identifier);
 
-    std::string safeBinaryOutput = _safeBinaryOutput((char *) &r, 6);
-
-    LOG(LogDebug, << "INFO: RX |"
-                  << safeBinaryOutput
-                  << "| bytes("
-                  << safeBinaryOutput.length()
-                  << ")"
-                  << std::endl);
+    APNS_LOG(LogDebug, << "INFO: RX |"
+                       << _safeBinaryOutput((const char *) r, ERROR_RESPONSE_SIZE)
+                       << "| bytes("
+                       << ERROR_RESPONSE_SIZE
+                       << ")"
+                       << std::endl);
 
     if ((int) command !=  ERROR_RESPONSE_COMMAND) {
-      LOG(LogWarn, << "Reponse command unknown: "
-                   << (int) command
-                   << " for [custom identifier: "
-                   << identifier
-                   << "]"
-                   << std::endl);
+      APNS_LOG(LogWarn, << "Reponse command unknown: "
+                        << (int) command
+                        << " for [custom identifier: "
+                        << identifier
+                        << "]"
+                        << std::endl);
       return;
     } // if
 
+    MetricsRegistry::increment(_metrics.errors[(unsigned char) status], 1);
+
     // move message to the error queue
     aMessage = _findById(identifier);
+    flightRecorder().record(FLIGHT_ERROR_RESPONSE, identifier, 0, (unsigned char) status,
+                            aMessage != NULL ? aMessage->deviceToken().c_str() : NULL);
     if (aMessage != NULL) {
       _removeMessageFromQueue(aMessage, true);
       aMessage->error(status);
+      _requeueFramesAfter(aMessage);
+
+      if (status != ERR_NO_ERRORS)
+        _noteOutcome(aMessage, OUTCOME_FAILED, (unsigned char) status);
     } // if
 
     switch((int) status) {
       case ERR_NO_ERRORS:
-        LOG(LogInfo, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: NO ERROR ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogInfo, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: NO ERROR ("
+                          << status
+                          << ")"
+                          << std::endl);
         return;
         break;
       case ERR_PROCESSING_ERROR:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: PROCESSING ERROR ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: PROCESSING ERROR ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_MISSING_DEVICE_TOKEN:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: MISSING DEVICE TOKEN ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: MISSING DEVICE TOKEN ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_MISSING_TOPIC:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: MISSING TOPIC ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: MISSING TOPIC ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_MISSING_PAYLOAD:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: MISSING PAYLOAD ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: MISSING PAYLOAD ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_INVALID_TOKEN_SIZE:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: INVALID TOKEN SIZE ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: INVALID TOKEN SIZE ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_INVALID_TOPIC_SIZE:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: INVALID TOPIC SIZE ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: INVALID TOPIC SIZE ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_INVALID_PAYLOAD_SIZE:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: INVALID PAYLOAD SIZE ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: INVALID PAYLOAD SIZE ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
       case ERR_INVALID_TOKEN:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: INVALID TOKEN ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: INVALID TOKEN ("
+                          << status
+                          << ")"
+                          << std::endl);
+
+        if (aMessage != NULL && _deadTokenFilter != NULL)
+          _deadTokenFilter->add(aMessage->deviceToken(), time(NULL));
         break;
       case ERR_NONE_UNKNOWN:
-        LOG(LogWarn, << "Message reponse [custom identifier: "
-                     << (int) identifier
-                     << "]: NONE UNKNOWN ("
-                     << status
-                     << ")"
-                     << std::endl);
+        APNS_LOG(LogWarn, << "Message reponse [custom identifier: "
+                          << (int) identifier
+                          << "]: NONE UNKNOWN ("
+                          << status
+                          << ")"
+                          << std::endl);
         break;
     } // switch
 
   } // PushController::_processReponseFromApns
 
   // ### Queue Management ###
-  void PushController::add(ApnsMessage *aMessage) {
+  const bool PushController::add(ApnsMessage *aMessage) {
+    if (_draining) {
+      APNS_LOG(LogWarn, << "Refusing message while draining."
+                        << std::endl);
+      return false;
+    } // if
+
+    // sending it would only get the connection dropped
+    if (_deadTokenFilter != NULL && _deadTokenFilter->isDead(aMessage->deviceToken())) {
+      APNS_LOG(LogInfo, << "Refusing message for dead token "
+                        << aMessage->deviceToken()
+                        << std::endl);
+      _numStatsDeadTokens++;
+      MetricsRegistry::increment(_metrics.deadTokens, 1);
+      _recordOutcome(aMessage, OUTCOME_DROPPED, ERR_INVALID_TOKEN);
+      return false;
+    } // if
+
+    aMessage->_queuedUs = LatencyHistogram::now();
+
+    if (_rateLimiter != NULL && !_rateLimiter->allow(aMessage->deviceToken()))
+      return _overLimit(aMessage);
+
     _add(aMessage);
+
+    return true;
   } // PushController::add
 
+  const bool PushController::_overLimit(ApnsMessage *aMessage) {
+    heldMessageMapType::iterator ptr;
+    overLimitPolicyEnum policy = _overLimitPolicy;
+
+    _numStatsRateLimited++;
+    MetricsRegistry::increment(_metrics.rateLimited, 1);
+
+    // a full hold queue refuses anything that would grow it
+    if (policy != OVERLIMIT_DROP && _heldMessages.size() >= _maximumHeld
+        && (policy == OVERLIMIT_DELAY || !_heldMessages.count(aMessage->deviceToken())))
+      policy = OVERLIMIT_DROP;
+
+    switch(policy) {
+      case OVERLIMIT_DELAY:
+        _heldMessages.insert(std::make_pair(aMessage->deviceToken(), aMessage));
+        _numRateDelayed++;
+        break;
+      case OVERLIMIT_COLLAPSE:
+        // only the latest state is worth sending once the token may send again
+        ptr = _heldMessages.find(aMessage->deviceToken());
+        if (ptr != _heldMessages.end()) {
+          _noteOutcome(ptr->second, OUTCOME_DROPPED, ERR_NO_ERRORS);
+          delete ptr->second;
+          ptr->second = aMessage;
+          _numRateCollapsed++;
+          break;
+        } // if
+
+        _heldMessages.insert(std::make_pair(aMessage->deviceToken(), aMessage));
+        _numRateDelayed++;
+        break;
+      default:
+        APNS_LOG(LogInfo, << "Refusing message over rate limit for token "
+                          << aMessage->deviceToken()
+                          << (policy != _overLimitPolicy ? ", hold queue is full." : "")
+                          << std::endl);
+        _numRateDropped++;
+        _recordOutcome(aMessage, OUTCOME_DROPPED, ERR_NO_ERRORS);
+        return false;
+    } // switch
+
+    return true;
+  } // PushController::_overLimit
+
+  // Queue held messages whose tokens are back under the limit, oldest
+  // first per token.  The limiter works in whole seconds so once a second
+  // is often enough.
+  void PushController::_releaseHeldMessages() {
+    heldMessageMapType::iterator ptr;
+    unsigned int numRows = 0;
+    time_t now = time(NULL);
+
+    if (_heldMessages.empty() || now == _releaseHeldTs)
+      return;
+
+    _releaseHeldTs = now;
+
+    for(ptr = _heldMessages.begin(); ptr != _heldMessages.end();) {
+      if (now > ptr->second->expiry()) {
+        _noteOutcome(ptr->second, OUTCOME_EXPIRED, ERR_NO_ERRORS);
+        delete ptr->second;
+        _heldMessages.erase(ptr++);
+        numRows++;
+        continue;
+      } // if
+
+      if (_rateLimiter == NULL || _rateLimiter->allow(ptr->first)) {
+        _add(ptr->second);
+        _heldMessages.erase(ptr++);
+        continue;
+      } // if
+
+      // the rest for this token would be refused too
+      ptr = _heldMessages.upper_bound(ptr->first);
+    } // for
+
+    if (numRows > 0)
+      APNS_LOG(LogNotice, << "Expired "
+                          << numRows
+                          << " message"
+                          << (numRows == 1 ? "" : "s")
+                          << " from held queue."
+                          << std::endl);
+  } // PushController::_releaseHeldMessages
+
+  // Depths are cheap and kept current; finding the oldest message means
+  // a walk over every queue, so that is done once a second.
+  void PushController::_updateQueueGauges() {
+    heldMessageMapType::iterator ptr;
+    uint64_t now;
+    uint64_t oldest;
+
+    MetricsRegistry::set(_metrics.queueDepth[METRICS_QUEUE_SEND], _messageSendQueue.size());
+    MetricsRegistry::set(_metrics.queueDepth[METRICS_QUEUE_STAGE], _messageStageQueue.size());
+    MetricsRegistry::set(_metrics.queueDepth[METRICS_QUEUE_ERROR], _messageErrorQueue.size());
+    MetricsRegistry::set(_metrics.queueDepth[METRICS_QUEUE_HELD], _heldMessages.size());
+
+    if (time(NULL) == _queueAgeTs)
+      return;
+
+    _queueAgeTs = time(NULL);
+    now = LatencyHistogram::now();
+
+    MetricsRegistry::set(_metrics.queueOldestUs[METRICS_QUEUE_SEND], _oldestQueued(_messageSendQueue, now));
+    MetricsRegistry::set(_metrics.queueOldestUs[METRICS_QUEUE_STAGE], _oldestQueued(_messageStageQueue, now));
+    MetricsRegistry::set(_metrics.queueOldestUs[METRICS_QUEUE_ERROR], _oldestQueued(_messageErrorQueue, now));
+
+    oldest = now;
+    for(ptr = _heldMessages.begin(); ptr != _heldMessages.end(); ptr++) {
+      if (ptr->second->_queuedUs && ptr->second->_queuedUs < oldest)
+        oldest = ptr->second->_queuedUs;
+    } // for
+    MetricsRegistry::set(_metrics.queueOldestUs[METRICS_QUEUE_HELD], now - oldest);
+  } // PushController::_updateQueueGauges
+
+  const uint64_t PushController::_oldestQueued(const messageQueueType &queue, const uint64_t now) {
+    messageQueueType::const_iterator ptr;
+    uint64_t oldest = now;
+
+    for(ptr = queue.begin(); ptr != queue.end(); ptr++) {
+      if ((*ptr)->_queuedUs && (*ptr)->_queuedUs < oldest)
+        oldest = (*ptr)->_queuedUs;
+    } // for
+
+    return now - oldest;
+  } // PushController::_oldestQueued
+
+  // Each message's outcome is reported once, whatever path it takes out.
+  void PushController::_noteOutcome(ApnsMessage *aMessage, const pushOutcomeEnum outcome, const int status) {
+    if (_outcomeHandler == NULL || aMessage->_outcomeReported)
+      return;
+
+    aMessage->_outcomeReported = true;
+    _recordOutcome(aMessage, outcome, status);
+  } // PushController::_noteOutcome
+
+  // Also used for messages add() hands back, which the caller still owns
+  // and may offer again.
+  void PushController::_recordOutcome(const ApnsMessage *aMessage, const pushOutcomeEnum outcome, const int status) {
+    PushOutcome o;
+
+    if (_outcomeHandler == NULL)
+      return;
+
+    o.customIdentifier = aMessage->customIdentifier();
+    o.deviceToken = aMessage->deviceToken();
+    o.id = aMessage->id();
+    o.outcome = outcome;
+    o.status = status;
+    o.ts = time(NULL);
+
+    _outcomes.push_back(o);
+  } // PushController::_recordOutcome
+
+  void PushController::_deliverOutcomes() {
+    if (_outcomes.empty())
+      return;
+
+    if (_outcomeHandler != NULL)
+      _outcomeHandler->onOutcomes(&_outcomes[0], _outcomes.size());
+
+    _outcomes.clear();
+  } // PushController::_deliverOutcomes
+
+  const unsigned int PushController::_clearHeldMessages(messageQueueType &unsent) {
+    heldMessageMapType::iterator ptr;
+    unsigned int numRows = _heldMessages.size();
+
+    for(ptr = _heldMessages.begin(); ptr != _heldMessages.end(); ptr++)
+      unsent.insert(ptr->second);
+    _heldMessages.clear();
+
+    return numRows;
+  } // PushController::_clearHeldMessages
+
   void PushController::_add(ApnsMessage *aMessage) {
     assert(aMessage != NULL);
 
-    // Set id for message, probably never have over 1024 messages
-    // in the queue.
-    aMessage->id(++_lastId % 1024);
+    // Set id for message; the frame carries all 32 bits, so ids only
+    // repeat after 2^32 messages rather than within one send queue.
+    aMessage->id(++_lastId);
 
     // update our last activity
     _lastActivityTs = time(NULL);
@@ -388,8 +1201,16 @@ namespace apns {
   } // PushController::_remove
 
   ApnsMessage *PushController::_findById(const unsigned int id) {
+    inflightFrameQueueType::reverse_iterator iptr;
     messageQueueType::iterator ptr;
 
+    // should ids ever wrap, the most recently written frame with it is
+    // the one APNs is talking about
+    for(iptr = _inflightFrames.rbegin(); iptr != _inflightFrames.rend(); iptr++) {
+      if (_messageStageQueue.count(iptr->second) && iptr->second->id() == id)
+        return iptr->second;
+    } // for
+
     ptr = _messageStageQueue.begin();
     while(ptr != _messageStageQueue.end()) {
       if ((*ptr)->id() == id)
@@ -418,12 +1239,13 @@ namespace apns {
 
   const unsigned int PushController::_clearMessagesFromQueue(messageQueueType &messageQueue) {
     const unsigned int numRows = messageQueue.size();
-    messageQueueType::iterator ptr;
+    ApnsMessage *aMessage;
 
     while(!messageQueue.empty()) {
-      ptr = messageQueue.begin();
-      messageQueue.erase(ptr);
-      delete (*ptr);
+      aMessage = *messageQueue.begin();
+      messageQueue.erase(messageQueue.begin());
+      _noteOutcome(aMessage, aMessage->_writtenUs ? OUTCOME_SENT : OUTCOME_DROPPED, ERR_NO_ERRORS);
+      delete aMessage;
     } // while
 
     return numRows;
@@ -432,6 +1254,7 @@ namespace apns {
   const unsigned int PushController::_removeExpiredMessagesFromQueue(messageQueueType &messageQueue) {
     messageQueueType::iterator ptr;
     messageQueueType removeMe;
+    ApnsMessage *aMessage;
     std::string queueName = "";
     unsigned int numRows = 0;
 
@@ -443,17 +1266,22 @@ namespace apns {
       ptr++;
     } // while
 
-    while(!removeMe.empty()) {
-      ptr = removeMe.begin();
-      messageQueue.erase((*ptr));
-      removeMe.erase((*ptr));
+    _forgetFrames(removeMe);
+
+    for(ptr = removeMe.begin(); ptr != removeMe.end(); ptr++) {
+      aMessage = *ptr;
+      messageQueue.erase(aMessage);
 
       // we're expire, remove it
-      //_logf("STATUS: Expired message [custom identifier: %d]: Removed from queue.", (*ptr)->id());
+      //_logf("STATUS: Expired message [custom identifier: %d]: Removed from queue.", aMessage->id());
 
-      delete (*ptr);
+      // staged messages wait out their expiry after being written, one
+      // waiting to be sent again was not delivered however often it was
+      const bool sent = &messageQueue == &_messageStageQueue && aMessage->_writtenUs;
+      _noteOutcome(aMessage, sent ? OUTCOME_SENT : OUTCOME_EXPIRED, ERR_NO_ERRORS);
+      delete aMessage;
       numRows++;
-    } // while
+    } // for
 
     return numRows;
   } // PushController::_removeExpiredMessagesFromQueue
@@ -465,66 +1293,72 @@ namespace apns {
     if (ptr == _messageStageQueue.end())
       throw PushController_Exception("Unable to find ApnsMessage");
 
-    _messageStageQueue.erase(*ptr);
+    _messageStageQueue.erase(ptr);
 
     if (error)
-      _messageErrorQueue.insert(*ptr);
+      _messageErrorQueue.insert(aMessage);
     else
-      delete *ptr;
+      delete aMessage;
 
   } // PushController::_removeMessageFromQueue
 
   const bool PushController::_sendPayload(ApnsMessage *aMessage) {
     ApnsPacket_Enhanced_t p;
-    std::string payloadString;
     char deviceTokenHex[aMessage->deviceToken().length()+1];
-    char payload[MAXPAYLOAD_SIZE];
     size_t payloadLen;
-    int ret;
+    bool sampled;
 
     // Should never happen, we are only called by _buildPacket which
     // will set this when done.
     assert(aMessage != NULL);
 
     // Should we retry?
-    if (!aMessage->retry()) {
-      LOG(LogWarn, << "Giving up on message [custom identifier: "
-                   << aMessage->id()
-                   << "] after retry ("
-                   << aMessage->retries()
-                   << ") count expired."
-                   << std::endl);
+    if (aMessage->retriesExhausted()) {
+      APNS_LOG(LogWarn, << "Giving up on message [custom identifier: "
+                        << aMessage->id()
+                        << "] after retry ("
+                        << aMessage->retries()
+                        << ") count expired."
+                        << std::endl);
+      _noteOutcome(aMessage, OUTCOME_RETRIES_EXHAUSTED, ERR_NO_ERRORS);
       _removeMessageFromQueue(aMessage, false);
       return false;
     } // if
 
+    // Raw payloads are referenced in place, only built payloads
+    // are serialized here.
+    const std::string *payload;
     try {
-      payloadString = aMessage->getPayload();
+      payload = &aMessage->_buildPayload(_maxPayloadSize);
     } // try
-    catch(ApnsMessage_Exception e) {
-      LOG(LogWarn, << "Message removed [custom identifier: "
-                   << aMessage->id()
-                   << "]: "
-                   << e.message());
+    catch(const ApnsMessage_Exception &e) {
+      APNS_LOG(LogWarn, << "Message removed [custom identifier: "
+                        << aMessage->id()
+                        << "]: "
+                        << e.message());
       aMessage->error(ERR_INVALID_PAYLOAD_SIZE);
       _removeMessageFromQueue(aMessage, true);
+      _noteOutcome(aMessage, OUTCOME_FAILED, ERR_INVALID_PAYLOAD_SIZE);
       return false;
     } // catch
 
     strncpy(deviceTokenHex, aMessage->deviceToken().c_str(), sizeof(deviceTokenHex));
-    strncpy(payload, payloadString.c_str(), sizeof(payload));
-    payloadLen = payloadString.length();
+    payloadLen = payload->length();
 
     bzero(&p, sizeof(p));
 
-    LOG(LogDebug, << "Sending["
-                  << deviceTokenHex
-                  << "] of ("
-                  << payload
-                  << ") "
-                  << payloadLen
-                  << " bytes"
-                  << std::endl);
+    // per message logging is sampled, see logSampleRate()
+    sampled = _sampleMessageLog();
+
+    if (sampled)
+      APNS_LOG(LogDebug, << "Sending["
+                       << deviceTokenHex
+                       << "] of ("
+                       << *payload
+                       << ") "
+                       << payloadLen
+                       << " bytes"
+                       << std::endl);
 
     p.command = (char) COMMAND_PUSH_ENHANCED;
     //p.command = COMMAND_PUSH_ENHANCED;
@@ -568,9 +1402,6 @@ namespace apns {
       } // else
     } // while
 
-    // payload
-    memcpy(p.payload, payload, payloadLen);
-
     //int payloadOffset = sizeof(uint8_t) + sizeof(uint16_t) + DEVICE_BINARY_SIZE + sizeof(uint16_t);
     int payloadOffset = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint16_t) + DEVICE_BINARY_SIZE + sizeof(uint16_t);
     int packetLen = payloadOffset+payloadLen;
@@ -589,69 +1420,93 @@ namespace apns {
     ptr += DEVICE_BINARY_SIZE;
     memcpy(ptr, &p.payloadLen, sizeof(uint16_t));
     ptr += sizeof(uint16_t);
-    memcpy(ptr, &p.payload, payloadLen);
-
-    ret = write((char *) &packet, packetLen);
+    memcpy(ptr, payload->data(), payloadLen);
 
-    LOG(LogDebug, << "Write returned: "
-                  << ret
-                  << std::endl);
-
-    if (ret < 1 || ret != packetLen) {
-      // If we failed to write this packet, we need to put it back
+    // The frame goes out on the next flush(); we only count it as sent
+    // once every byte of it has been accepted by SSL_write.
+    if (!bufferWrite((char *) &packet, packetLen)) {
+      // If we failed to queue this packet, we need to put it back
       // into the queue
       _messageStageQueue.erase(aMessage);
       _messageSendQueue.insert(aMessage);
-      LOG(LogWarn, << "Unable to send message [customer identifier: "
-                   << aMessage->id()
-                   << "].  Wrote "
-                   << ret
-                   << " of "
-                   << packetLen
-                   << " bytes, pushing back to send queue."
-                   << std::endl);
+      APNS_LOG(LogWarn, << "Unable to send message [customer identifier: "
+                        << aMessage->id()
+                        << "].  Not connected, pushing back to send queue."
+                        << std::endl);
+      return false;
     } // if
 
-    LOG(LogDebug, << "TX |"
-                  << _safeBinaryOutput(packet, packetLen)
-                  << "| payloadOffset("
-                  << payloadOffset
-                  << ") packetLen("
-                  << payloadLen
-                  << ") bytes("
-                  << packetLen
-                  << ")"
-                  << std::endl);
-    LOG(LogNotice, << "Sending message [custom identifier: "
-                   << aMessage->id()
-                   << "]: "
-                   << packetLen
-                   << " bytes, try #"
-                   << aMessage->retries()
-                   << std::endl);
-
-    _numStatsSent++;
-
-    return ret ? true : false;
+    _pendingFrames.push_back(std::make_pair(bytesQueued(), aMessage));
+    flightRecorder().record(FLIGHT_FRAME, aMessage->id(), packetLen, aMessage->retries(), deviceTokenHex);
+
+    if (!sampled)
+      return true;
+
+    APNS_LOG(LogDebug, << "TX |"
+                       << _safeBinaryOutput(packet, packetLen)
+                       << "| payloadOffset("
+                       << payloadOffset
+                       << ") packetLen("
+                       << payloadLen
+                       << ") bytes("
+                       << packetLen
+                       << ")"
+                       << std::endl);
+    APNS_LOG(LogNotice, << "Sending message [custom identifier: "
+                        << aMessage->id()
+                        << "]: "
+                        << packetLen
+                        << " bytes, retries "
+                        << aMessage->retries()
+                        << (_logSampleRate > 1 ? " (sampled)" : "")
+                        << std::endl);
+
+    return true;
   } // PushController::_sendPayload
 
+  // True for one message in every logSampleRate().
+  const bool PushController::_sampleMessageLog() {
+    if (_logSampleRate <= 1)
+      return true;
+
+    return _logSampleCount++ % _logSampleRate == 0;
+  } // PushController::_sampleMessageLog
+
   void PushController::_logStats() {
     _logStatsTs = time(NULL) + _logStatsInterval;
 
-    LOG(LogNotice, << "Statistics Sent("
-                   << _numStatsSent
-                   << ") Errors("
-                   << _numStatsError
-                   << ") Disconnects("
-                   << _numStatsDisconnected
-                   << ") next in "
-                   << _logStatsInterval
-                   << " seconds"
-                   << std::endl);
+    APNS_LOG(LogNotice, << "Statistics Sent("
+                        << _numStatsSent
+                        << ") Errors("
+                        << _numStatsError
+                        << ") Disconnects("
+                        << _numStatsDisconnected
+                        << ") DeadTokens("
+                        << _numStatsDeadTokens
+                        << ") RateLimited("
+                        << _numStatsRateLimited
+                        << ") Held("
+                        << _heldMessages.size()
+                        << ") next in "
+                        << _logStatsInterval
+                        << " seconds"
+                        << std::endl);
 
     _numStatsSent = 0;
     _numStatsError = 0;
     _numStatsDisconnected = 0;
+    _numStatsDeadTokens = 0;
+    _numStatsRateLimited = 0;
+
+    APNS_LOG(LogNotice, << "Latency in microseconds queue "
+                        << _queueLatency.summary()
+                        << " confirm "
+                        << _confirmLatency.summary()
+                        << " connect "
+                        << connectLatency().summary()
+                        << " handshake "
+                        << handshakeLatency().summary()
+                        << std::endl);
   } // PushController::_logStats
 } // namespace apns
 
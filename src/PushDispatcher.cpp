@@ -0,0 +1,237 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include <openframe/openframe.h>
+
+#include "ApnsMessage.h"
+#include "PushController.h"
+#include "PushDispatcher.h"
+
+namespace apns {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** PushDispatcher Class                                                 **
+ **************************************************************************/
+  const char *PushDispatcher::SANDBOX_HOST			= "gateway.sandbox.push.apple.com";
+  const char *PushDispatcher::PRODUCTION_HOST			= "gateway.push.apple.com";
+  const int PushDispatcher::GATEWAY_PORT			= 2195;
+  const size_t PushDispatcher::DEFAULT_MAXIMUM_CONNECTIONS	= 4;
+  const size_t PushDispatcher::DEFAULT_MESSAGES_PER_CONNECTION	= 1000;
+
+  PushDispatcher::PushDispatcher(const std::string &certfile, const std::string &keyfile, const std::string &capath, const time_t timeout) :
+    _certfile(certfile), _keyfile(keyfile), _capath(capath), _timeout(timeout) {
+
+    _pools[ApnsMessage::APNS_ENVIRONMENT_DEVEL].host = SANDBOX_HOST;
+    _pools[ApnsMessage::APNS_ENVIRONMENT_PROD].host = PRODUCTION_HOST;
+
+    for(int i = 0; i < 2; i++) {
+      _pools[i].port = GATEWAY_PORT;
+      _pools[i].maxConnections = DEFAULT_MAXIMUM_CONNECTIONS;
+    } // for
+
+    _messagesPerConnection = DEFAULT_MESSAGES_PER_CONNECTION;
+    _draining = false;
+
+    return;
+  } // PushDispatcher::PushDispatcher
+
+  PushDispatcher::~PushDispatcher() {
+    std::vector<PushController *>::iterator ptr;
+
+    for(int i = 0; i < 2; i++) {
+      for(ptr = _pools[i].controllers.begin(); ptr != _pools[i].controllers.end(); ptr++)
+        delete (*ptr);
+      _pools[i].controllers.clear();
+    } // for
+
+    return;
+  } // PushDispatcher::~PushDispatcher
+
+  // Takes effect for connections opened afterwards, set it up front.
+  void PushDispatcher::gateway(const ApnsMessage::apnsEnvironmentEnum environment, const std::string &host, const int port) {
+    PushDispatcher_Pool &pool = _pool(environment);
+
+    pool.host = host;
+    pool.port = port;
+  } // PushDispatcher::gateway
+
+  void PushDispatcher::maxConnections(const ApnsMessage::apnsEnvironmentEnum environment, const size_t maxConnections) {
+    if (!maxConnections)
+      throw PushDispatcher_Exception("Need at least one connection per environment.");
+
+    _pool(environment).maxConnections = maxConnections;
+  } // PushDispatcher::maxConnections
+
+  const size_t PushDispatcher::maxConnections(const ApnsMessage::apnsEnvironmentEnum environment) const {
+    return _pool(environment).maxConnections;
+  } // PushDispatcher::maxConnections
+
+  const size_t PushDispatcher::numConnections(const ApnsMessage::apnsEnvironmentEnum environment) const {
+    return _pool(environment).controllers.size();
+  } // PushDispatcher::numConnections
+
+  const size_t PushDispatcher::sendQueueSize(const ApnsMessage::apnsEnvironmentEnum environment) const {
+    const PushDispatcher_Pool &pool = _pool(environment);
+    std::vector<PushController *>::const_iterator ptr;
+    size_t ret = 0;
+
+    for(ptr = pool.controllers.begin(); ptr != pool.controllers.end(); ptr++)
+      ret += (*ptr)->sendQueueSize();
+
+    return ret;
+  } // PushDispatcher::sendQueueSize
+
+  const PushDispatcher_Pool &PushDispatcher::_pool(const ApnsMessage::apnsEnvironmentEnum environment) const {
+    if (environment != ApnsMessage::APNS_ENVIRONMENT_DEVEL
+        && environment != ApnsMessage::APNS_ENVIRONMENT_PROD)
+      throw PushDispatcher_Exception("Unknown environment.");
+
+    return _pools[environment];
+  } // PushDispatcher::_pool
+
+  PushDispatcher_Pool &PushDispatcher::_pool(const ApnsMessage::apnsEnvironmentEnum environment) {
+    if (environment != ApnsMessage::APNS_ENVIRONMENT_DEVEL
+        && environment != ApnsMessage::APNS_ENVIRONMENT_PROD)
+      throw PushDispatcher_Exception("Unknown environment.");
+
+    return _pools[environment];
+  } // PushDispatcher::_pool
+
+  const bool PushDispatcher::add(ApnsMessage *aMessage) {
+    if (_draining) {
+      APNS_LOG(LogWarn, << "Refusing message while draining."
+                        << std::endl);
+      return false;
+    } // if
+
+    return _route(_pool(aMessage->environment()))->add(aMessage);
+  } // PushDispatcher::add
+
+  // The shallowest queue gets the message; once even that one is a full
+  // connection's worth behind, open another while the pool has room.
+  PushController *PushDispatcher::_route(PushDispatcher_Pool &pool) {
+    std::vector<PushController *>::iterator ptr;
+    PushController *best = NULL;
+
+    for(ptr = pool.controllers.begin(); ptr != pool.controllers.end(); ptr++) {
+      if (best == NULL || (*ptr)->sendQueueSize() < best->sendQueueSize())
+        best = *ptr;
+    } // for
+
+    if (best != NULL
+        && (best->sendQueueSize() < _messagesPerConnection
+            || pool.controllers.size() >= pool.maxConnections))
+      return best;
+
+    best = _createController(pool);
+    pool.controllers.push_back(best);
+
+    APNS_LOG(LogNotice, << "Opened connection #"
+                        << pool.controllers.size()
+                        << " to "
+                        << pool.host
+                        << ":"
+                        << pool.port
+                        << std::endl);
+
+    return best;
+  } // PushDispatcher::_route
+
+  PushController *PushDispatcher::_createController(const PushDispatcher_Pool &pool) {
+    PushController *pushController = new PushController(pool.host, pool.port, _certfile, _keyfile, _capath, _timeout);
+
+    // only look for error responses, never wait on them, so one gateway
+    // can't eat into the time spent on the other
+    pushController->readTimeout(0);
+
+    return pushController;
+  } // PushDispatcher::_createController
+
+  const bool PushDispatcher::run() {
+    std::vector<PushController *>::iterator ptr;
+
+    for(int i = 0; i < 2; i++) {
+      for(ptr = _pools[i].controllers.begin(); ptr != _pools[i].controllers.end(); ptr++)
+        (*ptr)->run();
+
+      _shrink(_pools[i]);
+    } // for
+
+    return true;
+  } // PushDispatcher::run
+
+  // Extra controllers go once idle expiry has closed them and they have
+  // nothing left to send or held; the first stays to keep its TLS session.
+  void PushDispatcher::_shrink(PushDispatcher_Pool &pool) {
+    PushController *pushController;
+    size_t i;
+
+    for(i = pool.controllers.size(); i > 1; i--) {
+      pushController = pool.controllers[i - 1];
+
+      if (pushController->isConnected() || pushController->isConnecting()
+          || pushController->sendQueueSize() || pushController->pendingBytes()
+          || pushController->heldQueueSize())
+        continue;
+
+      pool.controllers.erase(pool.controllers.begin() + (i - 1));
+      delete pushController;
+
+      APNS_LOG(LogNotice, << "Retired idle connection to "
+                          << pool.host
+                          << ":"
+                          << pool.port
+                          << ", "
+                          << pool.controllers.size()
+                          << " left."
+                          << std::endl);
+    } // for
+  } // PushDispatcher::_shrink
+
+  // Production first so a sandbox that can't be reached doesn't use up
+  // the time production had to finish.
+  const unsigned int PushDispatcher::drain(const time_t deadline, messageQueueType &unsent) {
+    std::vector<PushController *>::iterator ptr;
+    unsigned int numRows = 0;
+    int order[2] = { ApnsMessage::APNS_ENVIRONMENT_PROD, ApnsMessage::APNS_ENVIRONMENT_DEVEL };
+
+    _draining = true;
+
+    for(int i = 0; i < 2; i++) {
+      PushDispatcher_Pool &pool = _pools[order[i]];
+
+      for(ptr = pool.controllers.begin(); ptr != pool.controllers.end(); ptr++)
+        numRows += (*ptr)->drain(deadline, unsent);
+    } // for
+
+    return numRows;
+  } // PushDispatcher::drain
+} // namespace apns
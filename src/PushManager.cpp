@@ -0,0 +1,364 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openframe/openframe.h>
+
+#include "ApnsMessage.h"
+#include "PushController.h"
+#include "PushManager.h"
+
+namespace apns {
+  using namespace openframe::loglevel;
+
+/**************************************************************************
+ ** PushManager Class                                                    **
+ **************************************************************************/
+  const size_t PushManager::DEFAULT_QUANTUM		= 64;
+  const size_t PushManager::DEFAULT_WINDOW		= 512;
+  const int PushManager::DEFAULT_RUN_TIMEOUT		= 100;		// milliseconds
+  const int PushManager::CONNECTING_POLL_INTERVAL	= 10;		// milliseconds
+
+  PushManager::PushManager(const time_t timeout) : _timeout(timeout) {
+    _quantum = DEFAULT_QUANTUM;
+    _window = DEFAULT_WINDOW;
+    _draining = false;
+
+    return;
+  } // PushManager::PushManager
+
+  PushManager::~PushManager() {
+    messageQueueType unsent;
+    messageQueueType::iterator mptr;
+    tenantMapType::iterator ptr;
+
+    // one deadline for everybody rather than one per controller
+    drain(time(NULL) + PushController::DEFAULT_DRAIN_TIMEOUT, unsent);
+
+    for(mptr = unsent.begin(); mptr != unsent.end(); mptr++)
+      delete (*mptr);
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      if (ptr->second->controller != NULL)
+        delete ptr->second->controller;
+      delete ptr->second;
+    } // for
+
+    _tenants.clear();
+
+    return;
+  } // PushManager::~PushManager
+
+  void PushManager::addTenant(const std::string &name, const std::string &host, const int port, const std::string &certfile, const std::string &keyfile, const std::string &capath, const unsigned int weight) {
+    PushManager_Tenant *tenant;
+
+    if (isTenant(name))
+      throw PushManager_Exception("Tenant already exists.");
+
+    if (!weight)
+      throw PushManager_Exception("Tenant weight must be at least 1.");
+
+    tenant = new PushManager_Tenant;
+    tenant->name = name;
+    tenant->host = host;
+    tenant->port = port;
+    tenant->certfile = certfile;
+    tenant->keyfile = keyfile;
+    tenant->capath = capath;
+    tenant->weight = weight;
+    tenant->deficit = 0;
+    tenant->controller = NULL;
+
+    _tenants[name] = tenant;
+  } // PushManager::addTenant
+
+  // Hands back whatever the tenant had not sent yet.
+  const unsigned int PushManager::removeTenant(const std::string &name, messageQueueType &unsent) {
+    PushManager_Tenant *tenant = _find(name);
+    unsigned int numRows = 0;
+
+    if (tenant == NULL)
+      return 0;
+
+    for(; !tenant->queue.empty(); numRows++) {
+      unsent.insert(tenant->queue.front());
+      tenant->queue.pop_front();
+    } // for
+
+    if (tenant->controller != NULL) {
+      numRows += tenant->controller->drain(time(NULL) + tenant->controller->drainTimeout(), unsent);
+      delete tenant->controller;
+    } // if
+
+    _tenants.erase(name);
+    delete tenant;
+
+    return numRows;
+  } // PushManager::removeTenant
+
+  void PushManager::weight(const std::string &name, const unsigned int weight) {
+    PushManager_Tenant *tenant = _find(name);
+
+    if (tenant == NULL)
+      throw PushManager_Exception("Unknown tenant.");
+
+    if (!weight)
+      throw PushManager_Exception("Tenant weight must be at least 1.");
+
+    tenant->weight = weight;
+  } // PushManager::weight
+
+  const size_t PushManager::numActive() const {
+    tenantMapType::const_iterator ptr;
+    size_t ret = 0;
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      if (ptr->second->controller != NULL)
+        ret++;
+    } // for
+
+    return ret;
+  } // PushManager::numActive
+
+  const size_t PushManager::queueSize(const std::string &name) const {
+    PushManager_Tenant *tenant = _find(name);
+
+    if (tenant == NULL)
+      return 0;
+
+    return tenant->queue.size() + (tenant->controller != NULL ? tenant->controller->sendQueueSize() : 0);
+  } // PushManager::queueSize
+
+  PushManager_Tenant *PushManager::_find(const std::string &name) const {
+    tenantMapType::const_iterator ptr = _tenants.find(name);
+
+    return ptr == _tenants.end() ? NULL : ptr->second;
+  } // PushManager::_find
+
+  const bool PushManager::add(const std::string &name, ApnsMessage *aMessage) {
+    PushManager_Tenant *tenant;
+
+    if (_draining) {
+      APNS_LOG(LogWarn, << "Refusing message while draining."
+                        << std::endl);
+      return false;
+    } // if
+
+    if ((tenant = _find(name)) == NULL) {
+      APNS_LOG(LogWarn, << "Refusing message for unknown tenant "
+                        << name
+                        << std::endl);
+      return false;
+    } // if
+
+    tenant->queue.push_back(aMessage);
+
+    return true;
+  } // PushManager::add
+
+  PushController *PushManager::_createController(const PushManager_Tenant &tenant) {
+    PushController *pushController = new PushController(tenant.host, tenant.port, tenant.certfile, tenant.keyfile, tenant.capath, _timeout);
+
+    // we do the waiting, for every tenant at once
+    pushController->readTimeout(0);
+
+    return pushController;
+  } // PushManager::_createController
+
+  const bool PushManager::run(const int msec) {
+    tenantMapType::iterator ptr;
+    bool busy;
+
+    busy = _schedule();
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      if (ptr->second->controller == NULL)
+        continue;
+
+      ptr->second->controller->run();
+      _retire(ptr->second);
+    } // for
+
+    _wait(msec, busy);
+
+    return true;
+  } // PushManager::run
+
+  // One deficit round robin round; true if some tenant still has
+  // messages its controller could take right away.
+  const bool PushManager::_schedule() {
+    tenantMapType::iterator ptr;
+    bool busy = false;
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      PushManager_Tenant *tenant = ptr->second;
+
+      _schedule(tenant);
+
+      if (!tenant->queue.empty() && tenant->controller->sendQueueSize() < _window)
+        busy = true;
+    } // for
+
+    return busy;
+  } // PushManager::_schedule
+
+  void PushManager::_schedule(PushManager_Tenant *tenant) {
+    const size_t share = tenant->weight * _quantum;
+    ApnsMessage *aMessage;
+
+    if (tenant->queue.empty()) {
+      tenant->deficit = 0;
+      return;
+    } // if
+
+    if (tenant->controller == NULL) {
+      tenant->controller = _createController(*tenant);
+
+      APNS_LOG(LogInfo, << "Opening connection for tenant "
+                        << tenant->name
+                        << std::endl);
+    } // if
+
+    tenant->deficit += share;
+
+    while(tenant->deficit && !tenant->queue.empty()
+          && tenant->controller->sendQueueSize() < _window) {
+      aMessage = tenant->queue.front();
+
+      // left queued for drain() or removeTenant() to hand back
+      if (tenant->controller->isDraining())
+        break;
+
+      tenant->queue.pop_front();
+      tenant->deficit--;
+
+      // A dead token or one over its rate limit won't be taken on a
+      // later round either; the controller has reported it dropped.
+      if (!tenant->controller->add(aMessage))
+        delete aMessage;
+    } // while
+
+    // credit doesn't pile up while the tenant's own window holds it back
+    if (tenant->deficit > share)
+      tenant->deficit = share;
+
+    if (tenant->queue.empty())
+      tenant->deficit = 0;
+  } // PushManager::_schedule
+
+  // Idle expiry inside the controller has already closed the connection;
+  // with nothing left to send or held back by the rate limiter there is
+  // no reason to keep it around.
+  void PushManager::_retire(PushManager_Tenant *tenant) {
+    PushController *pushController = tenant->controller;
+
+    if (!tenant->queue.empty() || pushController->isConnected() || pushController->isConnecting()
+        || pushController->sendQueueSize() || pushController->pendingBytes()
+        || pushController->heldQueueSize())
+      return;
+
+    delete pushController;
+    tenant->controller = NULL;
+
+    APNS_LOG(LogInfo, << "Closed idle tenant "
+                      << tenant->name
+                      << std::endl);
+  } // PushManager::_retire
+
+  // Sleep on every open socket at once until one of them needs us or
+  // msec passes; busy means there is work waiting and we only poll.
+  const int PushManager::_wait(const int msec, const bool busy) {
+    std::vector<struct pollfd> pfds;
+    tenantMapType::iterator ptr;
+    struct pollfd pfd;
+    PushController *pushController;
+    int timeout = busy ? 0 : msec;
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      if ((pushController = ptr->second->controller) == NULL)
+        continue;
+
+      // still resolving, there is no socket to wait on yet
+      if (pushController->isConnecting() && pushController->fd() < 0 && timeout > CONNECTING_POLL_INTERVAL)
+        timeout = CONNECTING_POLL_INTERVAL;
+
+      if (pushController->fd() < 0)
+        continue;
+
+      pfd.fd = pushController->fd();
+      pfd.events = pushController->pollEvents();
+      pfd.revents = 0;
+
+      // more to frame as soon as the kernel has room for it
+      if (pushController->isConnected() && pushController->sendQueueSize())
+        pfd.events |= POLLOUT;
+
+      if (pfd.events)
+        pfds.push_back(pfd);
+    } // for
+
+    if (pfds.empty()) {
+      if (timeout > 0)
+        usleep(timeout * 1000);
+      return 0;
+    } // if
+
+    return poll(&pfds[0], pfds.size(), timeout);
+  } // PushManager::_wait
+
+  // Messages still waiting for the scheduler go straight back to the
+  // caller; what the controllers already have is drained against the
+  // shared deadline.
+  const unsigned int PushManager::drain(const time_t deadline, messageQueueType &unsent) {
+    tenantMapType::iterator ptr;
+    unsigned int numRows = 0;
+
+    _draining = true;
+
+    for(ptr = _tenants.begin(); ptr != _tenants.end(); ptr++) {
+      PushManager_Tenant *tenant = ptr->second;
+
+      for(; !tenant->queue.empty(); numRows++) {
+        unsent.insert(tenant->queue.front());
+        tenant->queue.pop_front();
+      } // for
+
+      tenant->deficit = 0;
+
+      if (tenant->controller != NULL)
+        numRows += tenant->controller->drain(deadline, unsent);
+    } // for
+
+    return numRows;
+  } // PushManager::drain
+} // namespace apns
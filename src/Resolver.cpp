@@ -0,0 +1,167 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <list>
+#include <new>
+
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "Resolver.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** Resolver Class                                                       **
+ **************************************************************************/
+  // Lookups we gave up on but glibc couldn't cancel; freed once they
+  // complete.
+  static pthread_mutex_t s_parkedMutex = PTHREAD_MUTEX_INITIALIZER;
+  static std::list<Resolver_Request *> s_parked;
+
+  Resolver::Resolver(const std::string &host, const int port) :
+    _host(host), _port(port) {
+    struct gaicb *list[1];
+    int ret;
+
+    _reap();
+
+    _status = RESOLVE_INPROGRESS;
+
+    try {
+      _request = new Resolver_Request;
+    } // try
+    catch(const std::bad_alloc &xa) {
+      assert(false);
+    } // catch
+
+    memset(_request, '\0', sizeof(Resolver_Request));
+    strncpy(_request->name, host.c_str(), sizeof(_request->name) - 1);
+    snprintf(_request->service, sizeof(_request->service), "%d", port);
+
+    _request->hints.ai_family = AF_UNSPEC;
+    _request->hints.ai_socktype = SOCK_STREAM;
+    _request->hints.ai_protocol = IPPROTO_TCP;
+    _request->hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+
+    _request->cb.ar_name = _request->name;
+    _request->cb.ar_service = _request->service;
+    _request->cb.ar_request = &_request->hints;
+
+    list[0] = &_request->cb;
+    ret = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+    if (ret != 0) {
+      _error = gai_strerror(ret);
+      _status = RESOLVE_FAILED;
+      delete _request;
+      _request = NULL;
+    } // if
+
+    return;
+  } // Resolver::Resolver
+
+  Resolver::~Resolver() {
+    if (_request != NULL)
+      _release(_request);
+
+    return;
+  } // Resolver::~Resolver
+
+  const Resolver::resolveStatusEnum Resolver::poll() {
+    int ret;
+
+    if (_status != RESOLVE_INPROGRESS)
+      return _status;
+
+    ret = gai_error(&_request->cb);
+    if (ret == EAI_INPROGRESS)
+      return _status;
+
+    if (ret != 0) {
+      _error = gai_strerror(ret);
+      _status = RESOLVE_FAILED;
+    } // if
+    else if (_request->cb.ar_result == NULL) {
+      _error = "No addresses returned.";
+      _status = RESOLVE_FAILED;
+    } // else if
+    else
+      _status = RESOLVE_DONE;
+
+    return _status;
+  } // Resolver::poll
+
+  const struct addrinfo *Resolver::result() const {
+    if (_status != RESOLVE_DONE)
+      return NULL;
+
+    return _request->cb.ar_result;
+  } // Resolver::result
+
+  void Resolver::_release(Resolver_Request *request) {
+    int ret = gai_error(&request->cb);
+
+    if (ret == EAI_INPROGRESS && gai_cancel(&request->cb) == EAI_NOTCANCELED) {
+      pthread_mutex_lock(&s_parkedMutex);
+      s_parked.push_back(request);
+      pthread_mutex_unlock(&s_parkedMutex);
+      return;
+    } // if
+
+    if (request->cb.ar_result != NULL)
+      freeaddrinfo(request->cb.ar_result);
+
+    delete request;
+  } // Resolver::_release
+
+  void Resolver::_reap() {
+    std::list<Resolver_Request *>::iterator ptr;
+
+    pthread_mutex_lock(&s_parkedMutex);
+
+    ptr = s_parked.begin();
+    while(ptr != s_parked.end()) {
+      if (gai_error(&(*ptr)->cb) == EAI_INPROGRESS) {
+        ptr++;
+        continue;
+      } // if
+
+      if ((*ptr)->cb.ar_result != NULL)
+        freeaddrinfo((*ptr)->cb.ar_result);
+
+      delete (*ptr);
+      ptr = s_parked.erase(ptr);
+    } // while
+
+    pthread_mutex_unlock(&s_parkedMutex);
+  } // Resolver::_reap
+} // namespace apns
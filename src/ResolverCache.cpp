@@ -0,0 +1,256 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "ResolverCache.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** ResolverCache Class                                                  **
+ **************************************************************************/
+  const time_t ResolverCache::DEFAULT_TTL		= 60;
+  const time_t ResolverCache::PENALTY_MINIMUM		= 5;
+  const time_t ResolverCache::PENALTY_MAXIMUM		= 300;
+
+  static pthread_mutex_t s_entryMutex = PTHREAD_MUTEX_INITIALIZER;
+  static ResolverCache::entryMapType s_entryMap;
+  static time_t s_ttl = ResolverCache::DEFAULT_TTL;
+
+  void ResolverCache::ttl(const time_t ttl) {
+    pthread_mutex_lock(&s_entryMutex);
+    s_ttl = ttl;
+    pthread_mutex_unlock(&s_entryMutex);
+  } // ResolverCache::ttl
+
+  const time_t ResolverCache::ttl() {
+    return s_ttl;
+  } // ResolverCache::ttl
+
+  const bool ResolverCache::isFresh(const std::string &host, const int port) {
+    entryMapType::iterator ptr;
+    bool ret = false;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+    if (ptr != s_entryMap.end())
+      ret = !ptr->second.addresses.empty() && time(NULL) < ptr->second.expireTs;
+
+    pthread_mutex_unlock(&s_entryMutex);
+
+    return ret;
+  } // ResolverCache::isFresh
+
+  const size_t ResolverCache::size(const std::string &host, const int port) {
+    entryMapType::iterator ptr;
+    size_t ret = 0;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+    if (ptr != s_entryMap.end())
+      ret = ptr->second.addresses.size();
+
+    pthread_mutex_unlock(&s_entryMutex);
+
+    return ret;
+  } // ResolverCache::size
+
+  const size_t ResolverCache::store(const std::string &host, const int port, const struct addrinfo *ai) {
+    ResolverCache_Entry entry;
+    ResolverCache_Address address;
+    ResolverCache_Address *known;
+    entryMapType::iterator ptr;
+    size_t ret;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+
+    for(; ai != NULL; ai = ai->ai_next) {
+      if (ai->ai_addrlen > sizeof(address.addr))
+        continue;
+
+      memset(&address, '\0', sizeof(address));
+      memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+      address.addrlen = ai->ai_addrlen;
+
+      if (_find(entry, address.addr, address.addrlen) != NULL)
+        continue;
+
+      // an address that survives the refresh keeps its penalty
+      if (ptr != s_entryMap.end()
+          && (known = _find(ptr->second, address.addr, address.addrlen)) != NULL)
+        address = *known;
+
+      entry.addresses.push_back(address);
+    } // for
+
+    // Every process sorts the lookup the same way, start each one
+    // somewhere different so they don't all pile onto the first.
+    entry.next = entry.addresses.empty() ? 0 : rand() % entry.addresses.size();
+    entry.expireTs = time(NULL) + s_ttl;
+
+    ret = entry.addresses.size();
+    s_entryMap[_key(host, port)] = entry;
+
+    pthread_mutex_unlock(&s_entryMutex);
+
+    return ret;
+  } // ResolverCache::store
+
+  const bool ResolverCache::pick(const std::string &host, const int port, struct sockaddr_storage &addr, socklen_t &addrlen) {
+    entryMapType::iterator ptr;
+    time_t now = time(NULL);
+    size_t numAddresses;
+    size_t i, idx, best;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+    if (ptr == s_entryMap.end() || ptr->second.addresses.empty()) {
+      pthread_mutex_unlock(&s_entryMutex);
+      return false;
+    } // if
+
+    ResolverCache_Entry &entry = ptr->second;
+    numAddresses = entry.addresses.size();
+
+    // next healthy address after the cursor; if every one of them is
+    // being penalized take whichever comes off penalty first
+    best = entry.next % numAddresses;
+    for(i = 0; i < numAddresses; i++) {
+      idx = (entry.next + i) % numAddresses;
+
+      if (entry.addresses[idx].penaltyTs <= now) {
+        best = idx;
+        break;
+      } // if
+
+      if (entry.addresses[idx].penaltyTs < entry.addresses[best].penaltyTs)
+        best = idx;
+    } // for
+
+    entry.next = best + 1;
+    addr = entry.addresses[best].addr;
+    addrlen = entry.addresses[best].addrlen;
+
+    pthread_mutex_unlock(&s_entryMutex);
+
+    return true;
+  } // ResolverCache::pick
+
+  void ResolverCache::failed(const std::string &host, const int port, const struct sockaddr_storage &addr, const socklen_t addrlen) {
+    ResolverCache_Address *address;
+    entryMapType::iterator ptr;
+    time_t penalty;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+    if (ptr != s_entryMap.end() && (address = _find(ptr->second, addr, addrlen)) != NULL) {
+      penalty = PENALTY_MINIMUM;
+      for(unsigned int i = 0; i < address->failures && penalty < PENALTY_MAXIMUM; i++)
+        penalty *= 2;
+
+      if (penalty > PENALTY_MAXIMUM)
+        penalty = PENALTY_MAXIMUM;
+
+      address->failures++;
+      address->penaltyTs = time(NULL) + penalty;
+    } // if
+
+    pthread_mutex_unlock(&s_entryMutex);
+  } // ResolverCache::failed
+
+  void ResolverCache::succeeded(const std::string &host, const int port, const struct sockaddr_storage &addr, const socklen_t addrlen) {
+    ResolverCache_Address *address;
+    entryMapType::iterator ptr;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    ptr = s_entryMap.find(_key(host, port));
+    if (ptr != s_entryMap.end() && (address = _find(ptr->second, addr, addrlen)) != NULL) {
+      address->failures = 0;
+      address->penaltyTs = 0;
+    } // if
+
+    pthread_mutex_unlock(&s_entryMutex);
+  } // ResolverCache::succeeded
+
+  const unsigned int ResolverCache::clear() {
+    unsigned int numRows;
+
+    pthread_mutex_lock(&s_entryMutex);
+
+    numRows = s_entryMap.size();
+    s_entryMap.clear();
+
+    pthread_mutex_unlock(&s_entryMutex);
+
+    return numRows;
+  } // ResolverCache::clear
+
+  const std::string ResolverCache::addressString(const struct sockaddr_storage &addr, const socklen_t addrlen) {
+    char host[NI_MAXHOST];
+
+    if (getnameinfo((const struct sockaddr *) &addr, addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+      return "unknown";
+
+    return host;
+  } // ResolverCache::addressString
+
+  ResolverCache_Address *ResolverCache::_find(ResolverCache_Entry &entry, const struct sockaddr_storage &addr, const socklen_t addrlen) {
+    std::vector<ResolverCache_Address>::iterator ptr;
+
+    for(ptr = entry.addresses.begin(); ptr != entry.addresses.end(); ptr++) {
+      if (ptr->addrlen == addrlen && !memcmp(&ptr->addr, &addr, addrlen))
+        return &(*ptr);
+    } // for
+
+    return NULL;
+  } // ResolverCache::_find
+
+  const std::string ResolverCache::_key(const std::string &host, const int port) {
+    std::stringstream s;
+
+    s << host << ":" << port;
+
+    return s.str();
+  } // ResolverCache::_key
+} // namespace apns
@@ -0,0 +1,226 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <map>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "SslContextCache.h"
+#include "SslController.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** SslContextCache Class                                                **
+ **************************************************************************/
+  const time_t SslContextCache::RELOAD_CHECK_INTERVAL		= 30;
+
+  static pthread_mutex_t s_contextMutex = PTHREAD_MUTEX_INITIALIZER;
+  static SslContextCache::contextMapType s_contextMap;
+  static unsigned int s_generation = 0;
+  static int s_server_session_id_context = 1;
+
+  SSL_CTX *SslContextCache::get(const std::string &certfile, const std::string &keyfile, const std::string &capath, unsigned int &generation, std::string &error) {
+    contextMapType::iterator ptr;
+    const std::string key = _key(certfile, keyfile, capath);
+    time_t now = time(NULL);
+    time_t certMtime, keyMtime;
+    ino_t certIno, keyIno;
+    SSL_CTX *ctx;
+
+    error = "";
+
+    pthread_mutex_lock(&s_contextMutex);
+
+    ptr = s_contextMap.find(key);
+    if (ptr == s_contextMap.end()) {
+      SslContextCache_Entry entry;
+
+      ctx = _build(certfile, keyfile, capath, error);
+      if (ctx == NULL) {
+        pthread_mutex_unlock(&s_contextMutex);
+        return NULL;
+      } // if
+
+      entry.ctx = ctx;
+      entry.generation = ++s_generation;
+      entry.nextCheckTs = now + RELOAD_CHECK_INTERVAL;
+      _stat(certfile, entry.certMtime, entry.certIno);
+      _stat(keyfile, entry.keyMtime, entry.keyIno);
+
+      ptr = s_contextMap.insert(std::make_pair(key, entry)).first;
+    } // if
+    else if (now >= ptr->second.nextCheckTs) {
+      SslContextCache_Entry &entry = ptr->second;
+
+      entry.nextCheckTs = now + RELOAD_CHECK_INTERVAL;
+
+      if (_stat(certfile, certMtime, certIno)
+          && _stat(keyfile, keyMtime, keyIno)
+          && (certMtime != entry.certMtime || certIno != entry.certIno
+              || keyMtime != entry.keyMtime || keyIno != entry.keyIno)) {
+
+        // Build the replacement before touching the live one so a
+        // half written renewal leaves us on the old certificate; the
+        // stat values are only updated on success so we retry.
+        ctx = _build(certfile, keyfile, capath, error);
+        if (ctx != NULL) {
+          SSL_CTX_free(entry.ctx);
+          entry.ctx = ctx;
+          entry.generation = ++s_generation;
+          entry.certMtime = certMtime;
+          entry.certIno = certIno;
+          entry.keyMtime = keyMtime;
+          entry.keyIno = keyIno;
+        } // if
+      } // if
+    } // else if
+
+    ctx = ptr->second.ctx;
+    generation = ptr->second.generation;
+    SSL_CTX_up_ref(ctx);
+
+    pthread_mutex_unlock(&s_contextMutex);
+
+    return ctx;
+  } // SslContextCache::get
+
+  const bool SslContextCache::preload(const std::string &certfile, const std::string &keyfile, const std::string &capath, std::string &error) {
+    unsigned int generation;
+    SSL_CTX *ctx;
+
+    ctx = get(certfile, keyfile, capath, generation, error);
+    if (ctx == NULL)
+      return false;
+
+    SSL_CTX_free(ctx);
+
+    return true;
+  } // SslContextCache::preload
+
+  const unsigned int SslContextCache::clear() {
+    contextMapType::iterator ptr;
+    unsigned int numRows;
+
+    pthread_mutex_lock(&s_contextMutex);
+
+    numRows = s_contextMap.size();
+    for(ptr = s_contextMap.begin(); ptr != s_contextMap.end(); ptr++)
+      SSL_CTX_free(ptr->second.ctx);
+
+    s_contextMap.clear();
+
+    pthread_mutex_unlock(&s_contextMutex);
+
+    return numRows;
+  } // SslContextCache::clear
+
+  SSL_CTX *SslContextCache::_build(const std::string &certfile, const std::string &keyfile, const std::string &capath, std::string &error) {
+    char errmsg[120];
+    SSL_CTX *ctx;
+
+    // Create an SSL_CTX structure
+    ctx = SSL_CTX_new(TLSv1_2_client_method());
+    if (!ctx) {
+      error = "Could not get SSL context.";
+      return NULL;
+    } // if
+
+    // Load the CA from the Path
+    if (SSL_CTX_load_verify_locations(ctx, NULL, capath.c_str()) <= 0) {
+      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+      error = "Failed to set CA location: (" + capath + ") " + errmsg;
+      SSL_CTX_free(ctx);
+      return NULL;
+    } // if
+
+    // Load the client certificate into the SSL_CTX structure
+    if (SSL_CTX_use_certificate_file(ctx, certfile.c_str(), SSL_FILETYPE_PEM) <= 0) {
+      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+      error = "Cannot use certificate file: (" + certfile + ") " + errmsg;
+      SSL_CTX_free(ctx);
+      return NULL;
+    } // if
+
+    // Load the private-key corresponding to the client certificate
+    if (SSL_CTX_use_PrivateKey_file(ctx, keyfile.c_str(), SSL_FILETYPE_PEM) <= 0) {
+      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+      error = "Cannot use private key: (" + keyfile + ") " + errmsg;
+      SSL_CTX_free(ctx);
+      return NULL;
+    } // if
+
+    // Check if the client certificate and private-key matches
+    if (!SSL_CTX_check_private_key(ctx)) {
+      error = "Private key does not match the certificate public key.";
+      SSL_CTX_free(ctx);
+      return NULL;
+    } // if
+
+    SSL_CTX_set_session_id_context(ctx, (unsigned char *) &s_server_session_id_context, sizeof(s_server_session_id_context));
+
+    // Sessions (and TLS 1.3 tickets, which arrive after the handshake)
+    // are handed to the owning SslController through the new session
+    // callback rather than kept in the context's internal cache.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, SslController::_newSessionCallback);
+
+    return ctx;
+  } // SslContextCache::_build
+
+  const bool SslContextCache::_stat(const std::string &filename, time_t &mtime, ino_t &ino) {
+    struct stat st;
+
+    mtime = 0;
+    ino = 0;
+
+    if (stat(filename.c_str(), &st) == -1)
+      return false;
+
+    mtime = st.st_mtime;
+    ino = st.st_ino;
+
+    return true;
+  } // SslContextCache::_stat
+
+  const std::string SslContextCache::_key(const std::string &certfile, const std::string &keyfile, const std::string &capath) {
+    // NUL can't appear in a path so it makes a safe separator
+    std::string key = certfile;
+
+    key.append(1, '\0');
+    key += keyfile;
+    key.append(1, '\0');
+    key += capath;
+
+    return key;
+  } // SslContextCache::_key
+} // namespace apns
@@ -35,6 +35,7 @@
 #include <new>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -50,7 +51,13 @@
 #include <unistd.h>
 #include <math.h>
 #include <signal.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
+#include "ResolverCache.h"
+#include "SslContextCache.h"
 #include "SslController.h"
 
 namespace apns {
@@ -59,156 +66,332 @@ namespace apns {
 /**************************************************************************
  ** APNS Class                                                           **
  **************************************************************************/
-  static int s_server_session_id_context = 1;
+  static int s_ex_data_index = -1;
+
+  const time_t SslController::DEFAULT_RESOLVE_TIMEOUT		= 10;
+  const time_t SslController::DEFAULT_CONNECT_TIMEOUT		= 10;
+  const time_t SslController::DEFAULT_HANDSHAKE_TIMEOUT		= 10;
+  const int SslController::DEFAULT_READ_TIMEOUT		= 100;		// milliseconds
 
   SslController::SslController(const std::string &host, const int port, const std::string &certfile, const std::string &keyfile, const std::string &capath)
-    : _host(host), _port(port), _certfile(certfile), _keyfile(keyfile), _capath(capath) {
+    : _host(host), _port(port), _certfile(certfile), _keyfile(keyfile), _capath(capath),
+      _flightRecorder(FlightRecorder::DEFAULT_EVENTS) {
+    std::stringstream s;
 
     _initialized = false;
     _connected = false;
+    _sessionResumption = true;
+    _sessionHits = 0;
+    _sessionMisses = 0;
+    _session = NULL;
+    _contextGeneration = 0;
+    _state = STATE_DISCONNECTED;
+    _phaseTs = 0;
+    _phaseStartUs = 0;
+    _resolveTimeout = DEFAULT_RESOLVE_TIMEOUT;
+    _connectTimeout = DEFAULT_CONNECT_TIMEOUT;
+    _handshakeTimeout = DEFAULT_HANDSHAKE_TIMEOUT;
+    _readTimeout = DEFAULT_READ_TIMEOUT;
+    _sslWant = SSL_ERROR_NONE;
+    _sslcon = NULL;
+    _outOffset = 0;
+    _bytesQueued = 0;
+    _bytesFlushed = 0;
+    _kernelTls = false;
+    _ktlsSend = false;
+    _ktlsRecv = false;
+    memset(&_socketSample, '\0', sizeof(_socketSample));
+
+    s << host << ":" << port;
+    _flightRecorder.name(s.str());
+    if (!_flightRecorder.isRegistered())
+      APNS_LOG(LogWarn, << "Flight recorder for "
+                        << s.str()
+                        << " left out of dumpAll(), "
+                        << FlightRecorder::numUnregistered()
+                        << " over the limit of "
+                        << FlightRecorder::MAXIMUM_RECORDERS
+                        << "."
+                        << std::endl);
 
     return;
   } // SslController::SslController
 
   SslController::~SslController() {
+    // abandon a connect still in progress
+    if (_initialized)
+      _deinitialize();
+
+    _clearSession();
 
     return;
   } // SslController::~SslController
 
   const bool SslController::_connect() {
-    char errmsg[120];
+    std::string error;
+    unsigned int generation;
     int err;
-    int ofcmode;
+    socklen_t errlen;
 
     if (_connected)
       return false;
 
-    _initialize();
+    if (_state == STATE_DISCONNECTED) {
+      _initialize();
+      _salvaged.clear();
+
+      APNS_LOG(LogNotice, << "Connecting to "
+                          << _host
+                          << ":"
+                          << _port
+                          << std::endl);
+
+      // Shared context, built once per (cert, key, CA path) and
+      // rebuilt by the cache when the pem files change on disk.
+      _sslcon->ctx = SslContextCache::get(_certfile, _keyfile, _capath, generation, error);
+
+      if (!_sslcon->ctx)
+        return _connectFailed("Could not get SSL context: " + error);
+
+      if (error.length())
+        APNS_LOG(LogWarn, << "Certificate reload failed, still using previous: "
+                          << error
+                          << std::endl);
+
+      if (generation != _contextGeneration) {
+        // A session negotiated under the old certificate must not be
+        // resumed once the certificate has been replaced.
+        if (_contextGeneration)
+          APNS_LOG(LogNotice, << "Certificate reloaded for "
+                              << _host
+                              << ":"
+                              << _port
+                              << std::endl);
+        _clearSession();
+        _contextGeneration = generation;
+      } // if
+
+      _sslcon->meth = SSL_CTX_get_ssl_method(_sslcon->ctx);
+
+      // skip the lookup entirely while the cached addresses are fresh
+      if (ResolverCache::isFresh(_host, _port)) {
+        if (!_startConnect())
+          return false;
+      } // if
+      else if (!_startResolve())
+        return false;
+    } // if
 
-    LOG(LogNotice, << "Connecting to "
-                   << _host
-                   << ":"
-                   << _port
-                   << std::endl);
+    if (_state == STATE_RESOLVING) {
+      switch(_sslcon->resolver->poll()) {
+        case Resolver::RESOLVE_INPROGRESS:
+          if (!_phaseExpired(_resolveTimeout))
+            return false;
+          error = "Timed out resolving hostname.";
+          break;
+        case Resolver::RESOLVE_FAILED:
+          error = "Could not resolve hostname: " + _sslcon->resolver->error();
+          break;
+        case Resolver::RESOLVE_DONE:
+          ResolverCache::store(_host, _port, _sslcon->resolver->result());
+          break;
+      } // switch
 
-    // Create an SSL_METHOD structure (choose an SSL/TLS protocol version)
-    _sslcon->meth = TLSv1_2_client_method();
+      delete _sslcon->resolver;
+      _sslcon->resolver = NULL;
 
-    // Create an SSL_CTX structure
-    _sslcon->ctx = SSL_CTX_new(_sslcon->meth);
+      if (error.length()) {
+        // riding out a dns outage on the addresses we already had
+        if (!ResolverCache::size(_host, _port))
+          return _connectFailed(error);
 
-    if (!_sslcon->ctx) {
-      LOG(LogError, << "Could not get SSL context for "
-                    << _host
-                    << ":"
-                    << _port
-                    << std::endl);
-      _deinitialize();
-      return false;
+        APNS_LOG(LogWarn, << error
+                          << " Using stale addresses for "
+                          << _host
+                          << std::endl);
+      } // if
+
+      if (!_startConnect())
+        return false;
     } // if
 
-    // Load the CA from the Path
-    if (SSL_CTX_load_verify_locations(_sslcon->ctx, NULL, _capath.c_str()) <= 0) {
-      // Handle failed load here
-      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
-      LOG(LogError, << "Failed to set CA location: ("
-                    << _capath
-                    << ") "
-                    << errmsg
-                    << std::endl);
-      _deinitialize();
-      return false;
+    if (_state == STATE_CONNECTING) {
+      struct pollfd pfd;
+
+      pfd.fd = _sslcon->sock;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+
+      if (::poll(&pfd, 1, 0) < 1) {
+        if (_phaseExpired(_connectTimeout))
+          return _tryNextAddress("Timed out connecting.");
+        return false;
+      } // if
+
+      errlen = sizeof(err);
+      if (getsockopt(_sslcon->sock, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+        err = errno;
+
+      if (err != 0)
+        return _tryNextAddress(std::string("Could not connect: ") + strerror(err));
+
+      _flightRecorder.record(FLIGHT_CONNECTED, LatencyHistogram::now() - _phaseStartUs);
+      _connectLatency.recordSince(_phaseStartUs);
+
+      APNS_LOG(LogNotice, << "Connected to "
+                          << _host
+                          << ":"
+                          << _port
+                          << " ("
+                          << ResolverCache::addressString(_sslcon->server_addr, _sslcon->server_addr_len)
+                          << ")"
+                          << std::endl);
+
+      if (!_startHandshake())
+        return false;
     } // if
 
-    // Load the client certificate into the SSL_CTX structure
-    if (SSL_CTX_use_certificate_file(_sslcon->ctx, _certfile.c_str(), SSL_FILETYPE_PEM) <= 0) {
-      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
-      LOG(LogError, << "Cannot use certificate file: ("
-                    << _certfile
-                    << ") "
-                    << errmsg
-                    << std::endl);
-      //ERR_print_errors_fp(stderr);
-      _deinitialize();
-      return false;
+    // STATE_HANDSHAKING, driven by WANT_READ/WANT_WRITE
+    err = SSL_connect(_sslcon->ssl);
+    if (err != 1) {
+      _sslWant = SSL_get_error(_sslcon->ssl, err);
+      if (_sslWant == SSL_ERROR_WANT_READ || _sslWant == SSL_ERROR_WANT_WRITE) {
+        if (_phaseExpired(_handshakeTimeout))
+          return _tryNextAddress("Timed out performing SSL handshake.");
+        return false;
+      } // if
+
+      // don't offer a session the server may have choked on again
+      _clearSession();
+      return _tryNextAddress("Could not perform SSL handshake.");
     } // if
 
-    // Load the private-key corresponding to the client certificate
-    if (SSL_CTX_use_PrivateKey_file(_sslcon->ctx, _keyfile.c_str(), SSL_FILETYPE_PEM) <= 0) {
-      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
-      LOG(LogError, << "Cannot use private key: ("
-                    << _keyfile
-                    << ") "
-                    << errmsg
-                    << std::endl);
-      //ERR_print_errors_fp(stderr);
-      _deinitialize();
-      return false;
+    _flightRecorder.record(FLIGHT_HANDSHAKE, LatencyHistogram::now() - _phaseStartUs);
+    _handshakeLatency.recordSince(_phaseStartUs);
+
+    ResolverCache::succeeded(_host, _port, _sslcon->server_addr, _sslcon->server_addr_len);
+
+    if (_kernelTls) {
+#ifdef SSL_OP_ENABLE_KTLS
+      _ktlsSend = BIO_get_ktls_send(SSL_get_wbio(_sslcon->ssl));
+      _ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(_sslcon->ssl));
+#else
+      _ktlsSend = false;
+      _ktlsRecv = false;
+#endif
+
+      APNS_LOG(LogNotice, << "Kernel TLS with "
+                          << _host
+                          << ":"
+                          << _port
+                          << " send("
+                          << (_ktlsSend ? "on" : "off")
+                          << ") recv("
+                          << (_ktlsRecv ? "on" : "off")
+                          << ") cipher("
+                          << SSL_get_cipher_name(_sslcon->ssl)
+                          << ")"
+                          << std::endl);
     } // if
 
-    // Check if the client certificate and private-key matches
-    if (!SSL_CTX_check_private_key(_sslcon->ctx)) {
-      LOG(LogError, << "Private key does not match the certificate public key."
-                    << std::endl);
-      _deinitialize();
-      return false;
+    if (SSL_session_reused(_sslcon->ssl)) {
+      _sessionHits++;
+      APNS_LOG(LogDebug, << "Resumed TLS session with "
+                         << _host
+                         << ":"
+                         << _port
+                         << std::endl);
     } // if
- 
+    else
+      _sessionMisses++;
+
+    //_checkCert();
+
+    _state = STATE_CONNECTED;
+    _connected = true;
+
+    return true;
+  } // SslController::_connect
+
+  const bool SslController::_startResolve() {
+    try {
+      _sslcon->resolver = new Resolver(_host, _port);
+    } // try
+    catch(const std::bad_alloc &xa) {
+      assert(false);
+    } // catch
+
+    _state = STATE_RESOLVING;
+    _phaseTs = time(NULL);
+
+    return true;
+  } // SslController::_startResolve
+
+  const bool SslController::_startConnect() {
+    int ofcmode;
+    int err;
+
+    if (!ResolverCache::pick(_host, _port, _sslcon->server_addr, _sslcon->server_addr_len))
+      return _connectFailed("No addresses to connect to.");
+
+    _sslcon->attempts++;
+
     /* Set up a TCP socket */
-    _sslcon->sock = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if(_sslcon->sock == -1) {
-      LOG(LogError, << "Could not get socket."
-                    << std::endl);
-      _deinitialize();
-      return false;
-    } // if
+    _sslcon->sock = socket(_sslcon->server_addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if(_sslcon->sock == -1)
+      return _connectFailed("Could not get socket.");
+
+    /*First we make the socket nonblocking*/
+    ofcmode=fcntl(_sslcon->sock,F_GETFL,0);
+    ofcmode|=O_NDELAY;
+    if(fcntl(_sslcon->sock,F_SETFL,ofcmode))
+      return _connectFailed("Could not set socket to non-blocking.");
 
-    memset(&_sslcon->server_addr, '\0', sizeof(_sslcon->server_addr));
-    _sslcon->server_addr.sin_family      = AF_INET;
-    _sslcon->server_addr.sin_port        = htons(_port);       /* Server Port number */
-    _sslcon->host_info = gethostbyname(_host.c_str());
+    // buffer sizes have to be in place before connect for window scaling
+    _applySocketOptions();
 
-    if(_sslcon->host_info) {
-      /* Take the first IP */
-      struct in_addr *address = (struct in_addr *)_sslcon->host_info->h_addr_list[0];
-      _sslcon->server_addr.sin_addr.s_addr = inet_addr(inet_ntoa(*address)); /* Server IP */
-    } // if
-    else {
-      LOG(LogError, << "Could not resolve hostname, "
-                    << _host
-                    << std::endl);
-      _deinitialize();
-      return false;
-    } // if
+    _state = STATE_CONNECTING;
+    _phaseTs = time(NULL);
+    _phaseStartUs = LatencyHistogram::now();
+    _flightRecorder.record(FLIGHT_CONNECTING, _sslcon->attempts);
 
     /* Establish a TCP/IP connection to the SSL client */
-    err = ::connect(_sslcon->sock, (struct sockaddr*) &_sslcon->server_addr, sizeof(_sslcon->server_addr));
-    if(err == -1) {
-      LOG(LogError, << "Could not connect to "
-                    << _host
-                    << ":"
-                    << _port
-                    << std::endl);
-      _deinitialize();
-      return false;
-    } // if
+    err = ::connect(_sslcon->sock, (struct sockaddr*) &_sslcon->server_addr, _sslcon->server_addr_len);
+    if (err == -1 && errno != EINPROGRESS)
+      return _tryNextAddress(std::string("Could not connect: ") + strerror(errno));
 
-    LOG(LogNotice, << "Connected to "
-                   << _host
-                   << ":"
-                   << _port
-                   << std::endl);
+    return true;
+  } // SslController::_startConnect
 
+  const bool SslController::_startHandshake() {
     // An SSL structure is created
     _sslcon->ssl = SSL_new(_sslcon->ctx);
-    if(!_sslcon->ssl) {
-      LOG(LogError, << "Could not get SSL socket."
-                    << std::endl);
-      _deinitialize();
-      return false;
+    if(!_sslcon->ssl)
+      return _connectFailed("Could not get SSL socket.");
+
+    // Lets _newSessionCallback find its way back to us.
+    if (s_ex_data_index == -1)
+      s_ex_data_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+    SSL_set_ex_data(_sslcon->ssl, s_ex_data_index, this);
+
+    if (_sessionResumption && _session != NULL) {
+      if (SSL_SESSION_is_resumable(_session))
+        SSL_set_session(_sslcon->ssl, _session);
+      else
+        _clearSession();
     } // if
 
-    SSL_CTX_set_session_id_context(_sslcon->ctx, (unsigned char *) &s_server_session_id_context, sizeof(s_server_session_id_context));
+    // Let flush() hand over whatever the socket takes and retry from
+    // a buffer that may have been compacted or grown in between.
+    SSL_set_mode(_sslcon->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    // OpenSSL hands the keys to the kernel itself once the handshake is
+    // done, provided the kernel tls module and the cipher allow it.
+    if (_kernelTls)
+      SSL_set_options(_sslcon->ssl, SSL_OP_ENABLE_KTLS);
+#endif
 
     // Assign the socket into the SSL structure (SSL and socket without BIO)
     SSL_set_fd(_sslcon->ssl, _sslcon->sock);
@@ -216,34 +399,195 @@ namespace apns {
     _sslcon->sbio = BIO_new_socket(_sslcon->sock,BIO_NOCLOSE);
     SSL_set_bio(_sslcon->ssl,_sslcon->sbio,_sslcon->sbio);
 
-    // Perform SSL Handshake on the SSL client
-    err = SSL_connect(_sslcon->ssl);
-    if(err == -1) {
-      LOG(LogError, << "Could not perform SSL handshake to "
-                    << _host
-                    << ":"
-                    << _port
-                    << std::endl);
-      _deinitialize();
-      return false;
+    _state = STATE_HANDSHAKING;
+    _phaseTs = time(NULL);
+    _phaseStartUs = LatencyHistogram::now();
+    _sslWant = SSL_ERROR_WANT_WRITE;
+
+    return true;
+  } // SslController::_startHandshake
+
+  // Penalize the address that just failed us and move straight on to
+  // the next one, giving up once every address has had a go.
+  const bool SslController::_tryNextAddress(const std::string &reason) {
+    ResolverCache::failed(_host, _port, _sslcon->server_addr, _sslcon->server_addr_len);
+
+    if (_sslcon->attempts >= ResolverCache::size(_host, _port))
+      return _connectFailed(reason);
+
+    APNS_LOG(LogWarn, << "Could not connect to "
+                      << _host
+                      << ":"
+                      << _port
+                      << " via "
+                      << ResolverCache::addressString(_sslcon->server_addr, _sslcon->server_addr_len)
+                      << ", "
+                      << reason
+                      << " Trying next address."
+                      << std::endl);
+
+    if (_sslcon->ssl != NULL) {
+      SSL_free(_sslcon->ssl);
+      _sslcon->ssl = NULL;
+      _sslcon->sbio = NULL;
     } // if
 
-    /*First we make the socket nonblocking*/
-    ofcmode=fcntl(_sslcon->sock,F_GETFL,0);
-    ofcmode|=O_NDELAY;
-    if(fcntl(_sslcon->sock,F_SETFL,ofcmode)) {
-      LOG(LogError, << "Could not set socket to non-blocking"
-                    << std::endl);
-      _deinitialize();
-      return false;
+    if (_sslcon->sock != -1) {
+      close(_sslcon->sock);
+      _sslcon->sock = -1;
     } // if
 
-    //_checkCert();
+    _startConnect();
 
-    _connected = true;
+    return false;
+  } // SslController::_tryNextAddress
+
+  const bool SslController::_connectFailed(const std::string &reason) {
+    _flightRecorder.record(FLIGHT_CONNECT_FAILED, 0, errno, _state, NULL);
+
+    APNS_LOG(LogError, << "Could not connect to "
+                       << _host
+                       << ":"
+                       << _port
+                       << ", "
+                       << reason
+                       << std::endl);
+
+    _deinitialize();
+
+    return false;
+  } // SslController::_connectFailed
+
+  void SslController::_applySocketOptions() {
+    if (_socketOptions.noDelay)
+      _setSocketOption(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+    if (_socketOptions.sendBufferSize)
+      _setSocketOption(SOL_SOCKET, SO_SNDBUF, _socketOptions.sendBufferSize, "SO_SNDBUF");
+
+    if (_socketOptions.receiveBufferSize)
+      _setSocketOption(SOL_SOCKET, SO_RCVBUF, _socketOptions.receiveBufferSize, "SO_RCVBUF");
+
+    if (_socketOptions.userTimeout)
+      _setSocketOption(IPPROTO_TCP, TCP_USER_TIMEOUT, _socketOptions.userTimeout, "TCP_USER_TIMEOUT");
+
+    if (!_socketOptions.keepAlive)
+      return;
+
+    _setSocketOption(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+
+    if (_socketOptions.keepAliveIdle)
+      _setSocketOption(IPPROTO_TCP, TCP_KEEPIDLE, _socketOptions.keepAliveIdle, "TCP_KEEPIDLE");
+
+    if (_socketOptions.keepAliveInterval)
+      _setSocketOption(IPPROTO_TCP, TCP_KEEPINTVL, _socketOptions.keepAliveInterval, "TCP_KEEPINTVL");
+
+    if (_socketOptions.keepAliveCount)
+      _setSocketOption(IPPROTO_TCP, TCP_KEEPCNT, _socketOptions.keepAliveCount, "TCP_KEEPCNT");
+  } // SslController::_applySocketOptions
+
+  // Three syscalls; meant to be called once per batch, not per frame.
+  const bool SslController::sampleSocket() {
+    struct tcp_info info;
+    socklen_t infolen = sizeof(info);
+
+    if (!_connected)
+      return false;
+
+    if (ioctl(_sslcon->sock, SIOCOUTQ, &_socketSample.sendQueue) == -1
+        || ioctl(_sslcon->sock, SIOCOUTQNSD, &_socketSample.unsent) == -1
+        || getsockopt(_sslcon->sock, IPPROTO_TCP, TCP_INFO, &info, &infolen) == -1)
+      return false;
+
+    _socketSample.ts = time(NULL);
+    _socketSample.rtt = info.tcpi_rtt;
+    _socketSample.rttVar = info.tcpi_rttvar;
+    _socketSample.cwnd = info.tcpi_snd_cwnd;
+    _socketSample.mss = info.tcpi_snd_mss;
+    _socketSample.unacked = info.tcpi_unacked;
+    _socketSample.retransmits = info.tcpi_total_retrans;
+    _socketSample.lastAckRecv = info.tcpi_last_ack_recv;
 
     return true;
-  } // SslController::_connect
+  } // SslController::sampleSocket
+
+  // A socket option the kernel refuses isn't worth failing the connect.
+  void SslController::_setSocketOption(const int level, const int name, const int value, const char *label) {
+    if (setsockopt(_sslcon->sock, level, name, &value, sizeof(value)) == -1)
+      APNS_LOG(LogWarn, << "Could not set "
+                        << label
+                        << " on connection to "
+                        << _host
+                        << ":"
+                        << _port
+                        << ", "
+                        << strerror(errno)
+                        << std::endl);
+  } // SslController::_setSocketOption
+
+  const bool SslController::_phaseExpired(const time_t timeout) {
+    return timeout && time(NULL) >= _phaseTs + timeout;
+  } // SslController::_phaseExpired
+
+  const short SslController::pollEvents() const {
+    switch(_state) {
+      case STATE_CONNECTING:
+        return POLLOUT;
+        break;
+      case STATE_HANDSHAKING:
+        return _sslWant == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+        break;
+      case STATE_CONNECTED:
+        if (pendingBytes())
+          return POLLIN | (_sslWant == SSL_ERROR_WANT_READ ? 0 : POLLOUT);
+        return POLLIN;
+        break;
+      default:
+        break;
+    } // switch
+
+    return 0;
+  } // SslController::pollEvents
+
+  // Sleep until the socket is ready for whatever the connection is
+  // waiting on or msec passes; while resolving there is no socket yet.
+  const int SslController::waitForSocket(const int msec) {
+    struct pollfd pfd;
+
+    if (fd() < 0 || !pollEvents()) {
+      usleep(msec * 1000);
+      return 0;
+    } // if
+
+    pfd.fd = fd();
+    pfd.events = pollEvents();
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, msec);
+  } // SslController::waitForSocket
+
+  int SslController::_newSessionCallback(SSL *ssl, SSL_SESSION *session) {
+    SslController *sslController = (SslController *) SSL_get_ex_data(ssl, s_ex_data_index);
+
+    if (sslController == NULL || !sslController->_sessionResumption)
+      return 0;
+
+    // returning 1 tells OpenSSL we kept the reference
+    sslController->_storeSession(session);
+    return 1;
+  } // SslController::_newSessionCallback
+
+  void SslController::_storeSession(SSL_SESSION *session) {
+    _clearSession();
+    _session = session;
+  } // SslController::_storeSession
+
+  void SslController::_clearSession() {
+    if (_session != NULL)
+      SSL_SESSION_free(_session);
+
+    _session = NULL;
+  } // SslController::_clearSession
 
   // Check that the common name matches the host name
   const bool SslController::_checkCert() {
@@ -251,8 +595,8 @@ namespace apns {
     char peer_CN[256];
 
     if(SSL_get_verify_result(_sslcon->ssl) != X509_V_OK) {
-      LOG(LogWarn, << "Cannot verify certificate."
-                   << std::endl);
+      APNS_LOG(LogWarn, << "Cannot verify certificate."
+                        << std::endl);
       return false;
     } // if
 
@@ -265,8 +609,8 @@ namespace apns {
     X509_NAME_get_text_by_NID(X509_get_subject_name(peer), NID_commonName, peer_CN, 256);
 
     if(strcasecmp(peer_CN,_host.c_str())) {
-      LOG(LogWarn, << "Common name doesn't match host name"
-                   << std::endl);
+      APNS_LOG(LogWarn, << "Common name doesn't match host name"
+                        << std::endl);
       return false;
     } // if
 
@@ -276,26 +620,30 @@ namespace apns {
 
   const int SslController::write(const char *packet, const size_t len) {
     int ret = -1;
+    int err;
 
     if (!_connected)
       return ret;
 
     ret = SSL_write(_sslcon->ssl, packet, len);
+    err = SSL_get_error(_sslcon->ssl, ret);
+    if (err != SSL_ERROR_NONE && err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ)
+      _flightRecorder.record(FLIGHT_IO_ERROR, 0, errno, err, NULL);
 
-    switch(SSL_get_error(_sslcon->ssl, ret)){
+    switch(err) {
       // We wrote something
       case SSL_ERROR_NONE:
         return ret;
         break;
       case SSL_ERROR_ZERO_RETURN:
-        LOG(LogDebug, << "(SSL+TX) Zero Return"
-                      << std::endl);
+        APNS_LOG(LogDebug, << "(SSL+TX) Zero Return"
+                           << std::endl);
         disconnect();
         break;
       // We would have blocked */
       case SSL_ERROR_WANT_WRITE:
-        LOG(LogDebug, << "(SSL+TX) Want Write"
-                      << std::endl);
+        APNS_LOG(LogDebug, << "(SSL+TX) Want Write"
+                           << std::endl);
         return 0;
         break;
         /* We get a WANT_READ if we're
@@ -305,38 +653,139 @@ namespace apns {
            We need to wait on the socket to be readable
            but reinitiate our write when it is */
       case SSL_ERROR_WANT_READ:
-        LOG(LogDebug, << "(SSL+TX) Want Read"
-                      << std::endl);
+        APNS_LOG(LogDebug, << "(SSL+TX) Want Read"
+                           << std::endl);
         return 0;
         break;
       case SSL_ERROR_SYSCALL:
-        LOG(LogDebug, << "(SSL+TX) Syscall Failed"
-                      << std::endl);
+        APNS_LOG(LogDebug, << "(SSL+TX) Syscall Failed"
+                           << std::endl);
         disconnect();
         return -1;
         break;
       // Some other error */
       default:
-        LOG(LogDebug, << "(SSL+TX) Unknown Error"
-                      << std::endl);
+        APNS_LOG(LogDebug, << "(SSL+TX) Unknown Error"
+                           << std::endl);
         disconnect();
     } // switch
 
     return -1;
   } // SslController::write
 
+  const bool SslController::bufferWrite(const char *packet, const size_t len) {
+    if (!_connected)
+      return false;
+
+    _outBuffer.append(packet, len);
+    _bytesQueued += len;
+
+    return true;
+  } // SslController::bufferWrite
+
+  const int SslController::flush() {
+    int total = 0;
+    int ret;
+
+    if (!_connected)
+      return -1;
+
+    _sslWant = SSL_ERROR_NONE;
+
+    // hold partial segments back until the whole batch is written
+    const bool cork = _socketOptions.cork && _outOffset < _outBuffer.length();
+    if (cork)
+      _setSocketOption(IPPROTO_TCP, TCP_CORK, 1, "TCP_CORK");
+
+    while(_outOffset < _outBuffer.length()) {
+      if (_ktlsSend) {
+        // The kernel frames and encrypts records itself, plain send()
+        // is all that's needed.
+        ret = ::send(_sslcon->sock, _outBuffer.data() + _outOffset, _outBuffer.length() - _outOffset, MSG_NOSIGNAL);
+        if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+          _sslWant = SSL_ERROR_WANT_WRITE;
+          break;
+        } // if
+
+        if (ret == -1) {
+          _flightRecorder.record(FLIGHT_IO_ERROR, 0, errno, SSL_ERROR_SYSCALL, NULL);
+          APNS_LOG(LogDebug, << "(KTLS+TX) Send failed: "
+                             << strerror(errno)
+                             << std::endl);
+          _salvageRead();
+          disconnect();
+          return -1;
+        } // if
+
+        _outOffset += ret;
+        _bytesFlushed += ret;
+        total += ret;
+        continue;
+      } // if
+
+      ret = SSL_write(_sslcon->ssl, _outBuffer.data() + _outOffset, _outBuffer.length() - _outOffset);
+
+      if (ret > 0) {
+        _outOffset += ret;
+        _bytesFlushed += ret;
+        total += ret;
+        continue;
+      } // if
+
+      _sslWant = SSL_get_error(_sslcon->ssl, ret);
+      if (_sslWant == SSL_ERROR_WANT_WRITE || _sslWant == SSL_ERROR_WANT_READ)
+        // socket is full; the same bytes are retried on the next flush
+        break;
+
+      _flightRecorder.record(FLIGHT_IO_ERROR, 0, errno, _sslWant, NULL);
+      APNS_LOG(LogDebug, << "(SSL+TX) Flush failed ("
+                         << _sslWant
+                         << ")"
+                         << std::endl);
+      _salvageRead();
+      disconnect();
+      return -1;
+    } // while
+
+    if (cork)
+      _setSocketOption(IPPROTO_TCP, TCP_CORK, 0, "TCP_CORK");
+
+    if (_outOffset == _outBuffer.length()) {
+      _outBuffer.clear();
+      _outOffset = 0;
+    } // if
+    else if (_outOffset > _outBuffer.length() / 2) {
+      _outBuffer.erase(0, _outOffset);
+      _outOffset = 0;
+    } // else if
+
+    return total;
+  } // SslController::flush
+
   const int SslController::read(void *packet, const size_t len) {
     fd_set readfds;
     int ret = -1;
+    int err;
+
+    if (!_salvaged.empty()) {
+      ret = _salvaged.length() < len ? _salvaged.length() : len;
+      memcpy(packet, _salvaged.data(), ret);
+      _salvaged.erase(0, ret);
+      return ret;
+    } // if
 
     if (!_connected)
       return ret;
 
-    timeval timeout = {0, 100000};
+    timeval timeout = {_readTimeout / 1000, (_readTimeout % 1000) * 1000};
     FD_ZERO(&readfds);
     FD_SET(_sslcon->sock, &readfds);
 
-    ret = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
+    // a record already decrypted by OpenSSL won't show up on the socket
+    if (SSL_pending(_sslcon->ssl) > 0)
+      ret = 1;
+    else
+      ret = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
 
     if (ret == -1) {
       //_logf("SslController::read[select]> %s", strerror(errno));
@@ -358,31 +807,35 @@ namespace apns {
     assert(false);
   } // if
 
-  if (!FD_ISSET(_sslcon->sock, &readfds))
+  if (!SSL_pending(_sslcon->ssl) && !FD_ISSET(_sslcon->sock, &readfds))
     return -1;
 
   ret = SSL_read(_sslcon->ssl, packet, len);
-  switch(SSL_get_error(_sslcon->ssl, ret)) {
+  err = SSL_get_error(_sslcon->ssl, ret);
+  if (err != SSL_ERROR_NONE && err != SSL_ERROR_WANT_READ)
+    _flightRecorder.record(FLIGHT_IO_ERROR, 0, errno, err, NULL);
+
+  switch(err) {
     case SSL_ERROR_NONE:
       return ret;
       break;
     case SSL_ERROR_WANT_READ:
-      LOG(LogDebug, << "(SSL+RX) Want Read"
-                    << std::endl);
+      APNS_LOG(LogDebug, << "(SSL+RX) Want Read"
+                         << std::endl);
       break;
     case SSL_ERROR_ZERO_RETURN:
-      LOG(LogDebug, << "(SSL+RX) Returned Zero"
-                    << std::endl);
+      APNS_LOG(LogDebug, << "(SSL+RX) Returned Zero"
+                         << std::endl);
       disconnect();
       break;
     case SSL_ERROR_SYSCALL:
-      LOG(LogDebug, << "(SSL+RX) Syscall Failed"
-                    << std::endl);
+      APNS_LOG(LogDebug, << "(SSL+RX) Syscall Failed"
+                         << std::endl);
       disconnect();
       return -1;
     default:
-      LOG(LogDebug, << "(SSL+RX) Unknown"
-                    << std::endl);
+      APNS_LOG(LogDebug, << "(SSL+RX) Unknown"
+                         << std::endl);
       disconnect();
       return -1;
   } // switch
@@ -391,46 +844,72 @@ namespace apns {
     return ret;
   } // SslController::read
 
+  // A peer that answers and hangs up straight away (APNs after an error
+  // response) fails our next write with the answer still unread on the
+  // socket; keep whatever can be read without waiting for read().
+  void SslController::_salvageRead() {
+    char chunk[256];
+    int ret;
+
+    while((ret = SSL_read(_sslcon->ssl, chunk, sizeof(chunk))) > 0)
+      _salvaged.append(chunk, ret);
+
+    ERR_clear_error();
+  } // SslController::_salvageRead
+
   const bool SslController::_disconnect() {
     int err;
 
+    if (isConnecting()) {
+      APNS_LOG(LogNotice, << "Abandoning connect to "
+                          << _host
+                          << ":"
+                          << _port
+                          << std::endl);
+      _deinitialize();
+      return true;
+    } // if
+
     if (!_connected) {
-      LOG(LogNotice, << "Disconnect from "
-                     << _host
-                     << ":"
-                     << _port
-                     << " attempted but not connected."
-                     << std::endl);
+      APNS_LOG(LogNotice, << "Disconnect from "
+                          << _host
+                          << ":"
+                          << _port
+                          << " attempted but not connected."
+                          << std::endl);
       return false;
     } // if
 
-    LOG(LogNotice, << "Disconnecting from "
-                   << _host
-                   << ":"
-                   << _port
-                   << std::endl);
+    _flightRecorder.record(FLIGHT_DISCONNECT, (uint32_t) _bytesFlushed);
 
-    // Shutdown the client side of the SSL connection
+    APNS_LOG(LogNotice, << "Disconnecting from "
+                        << _host
+                        << ":"
+                        << _port
+                        << std::endl);
+
+    // Shutdown the client side of the SSL connection, a connection that
+    // has already failed can't send close_notify but still gets closed.
     err = SSL_shutdown(_sslcon->ssl);
     if (err == -1) {
-      LOG(LogError, << "Could not shutdown SSL with "
-                    << _host
-                    << ":"
-                    << _port
-                    << std::endl);
-      return false;
+      APNS_LOG(LogDebug, << "Could not shutdown SSL with "
+                         << _host
+                         << ":"
+                         << _port
+                         << std::endl);
     } // if
 
     /* Terminate communication on a socket */
     err = close(_sslcon->sock);
     if(err == -1) {
-      LOG(LogError, << "Could not close socket with "
-                    << _host
-                    << ":"
-                    << _port);
+      APNS_LOG(LogError, << "Could not close socket with "
+                         << _host
+                         << ":"
+                         << _port);
       return false;
     } // if
 
+    _sslcon->sock = -1;
     _deinitialize();
 
     return true;
@@ -445,12 +924,17 @@ namespace apns {
     try {
       _sslcon = new SSL_Connection;
     } // try
-    catch(std::bad_alloc xa) {
+    catch(const std::bad_alloc &xa) {
       assert(false);
     } // catch
 
     _sslcon->ssl = NULL;
     _sslcon->ctx = NULL;
+    _sslcon->sbio = NULL;
+    _sslcon->resolver = NULL;
+    _sslcon->server_addr_len = 0;
+    _sslcon->attempts = 0;
+    _sslcon->sock = -1;
 
     // initialize OpenSSL library
     //SSL_library_init();
@@ -466,12 +950,27 @@ namespace apns {
     if (_sslcon->ssl != NULL)
       SSL_free(_sslcon->ssl);
 
-    /* Free the SSL_CTX structure */
-    if (_sslcon->ctx != NULL);
-    SSL_CTX_free(_sslcon->ctx);
+    /* Release our reference on the shared SSL_CTX structure */
+    if (_sslcon->ctx != NULL)
+      SSL_CTX_free(_sslcon->ctx);
+
+    /* Abandon a lookup still in flight */
+    if (_sslcon->resolver != NULL)
+      delete _sslcon->resolver;
+
+    if (_sslcon->sock != -1)
+      close(_sslcon->sock);
+
+    // anything still buffered died with the connection
+    _outBuffer.clear();
+    _outOffset = 0;
+    _bytesQueued = _bytesFlushed;
 
     delete _sslcon;
     _sslcon = NULL;
+    _state = STATE_DISCONNECTED;
+    _ktlsSend = false;
+    _ktlsRecv = false;
     _connected = false;
     _initialized = false;
   } // SslController::_deinitialize
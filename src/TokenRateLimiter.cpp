@@ -0,0 +1,134 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "TokenRateLimiter.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** TokenRateLimiter Class                                               **
+ **************************************************************************/
+  const size_t TokenRateLimiter::DEFAULT_SLOTS		= 16384;
+
+  TokenRateLimiter::TokenRateLimiter(const unsigned int limit, const time_t window, const size_t slots) :
+    _limit(limit), _window(window) {
+    TokenRateLimiter_Slot empty;
+    size_t size = 1;
+
+    if (!limit || limit > 65535)
+      throw TokenRateLimiter_Exception("Rate limit must be between 1 and 65535.");
+
+    if (window < 1)
+      throw TokenRateLimiter_Exception("Rate limit window must be at least a second.");
+
+    while(size < slots)
+      size <<= 1;
+
+    memset(&empty, '\0', sizeof(empty));
+    _slots.assign(size, empty);
+
+    _numAllowed = 0;
+    _numLimited = 0;
+
+    pthread_mutex_init(&_mutex, NULL);
+
+    return;
+  } // TokenRateLimiter::TokenRateLimiter
+
+  TokenRateLimiter::~TokenRateLimiter() {
+    pthread_mutex_destroy(&_mutex);
+
+    return;
+  } // TokenRateLimiter::~TokenRateLimiter
+
+  // FNV-1a over the hex token, ignoring case and the spaces ApnsMessage
+  // allows, so we never have to decode it.
+  const uint64_t TokenRateLimiter::_hash(const std::string &deviceToken) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for(i = 0; i < deviceToken.length(); i++) {
+      if (deviceToken[i] == ' ')
+        continue;
+
+      hash ^= (unsigned char) tolower((unsigned char) deviceToken[i]);
+      hash *= 1099511628211ULL;
+    } // for
+
+    return hash;
+  } // TokenRateLimiter::_hash
+
+  const bool TokenRateLimiter::allow(const std::string &deviceToken) {
+    const uint64_t hash = _hash(deviceToken);
+    const uint32_t fingerprint = (uint32_t) (hash >> 32) | 1;
+    const time_t now = time(NULL);
+    const uint32_t window = now / _window;
+    TokenRateLimiter_Slot *slot;
+    unsigned int estimate;
+    bool ret;
+
+    pthread_mutex_lock(&_mutex);
+
+    slot = &_slots[hash & (_slots.size() - 1)];
+
+    // Resetting a live slot would let two colliding tokens clear each
+    // other's count forever, so they share it until the owner goes quiet.
+    if (slot->fingerprint != fingerprint && slot->window + 1 < window) {
+      slot->fingerprint = fingerprint;
+      slot->window = window;
+      slot->previous = 0;
+      slot->current = 0;
+    } // if
+    else if (slot->window != window) {
+      slot->previous = slot->window + 1 == window ? slot->current : 0;
+      slot->current = 0;
+      slot->window = window;
+    } // else if
+
+    // the part of the previous window still inside the last window() seconds
+    estimate = slot->current + slot->previous * (_window - now % _window) / _window;
+
+    ret = estimate < _limit;
+    if (ret) {
+      slot->current++;
+      _numAllowed++;
+    } // if
+    else
+      _numLimited++;
+
+    pthread_mutex_unlock(&_mutex);
+
+    return ret;
+  } // TokenRateLimiter::allow
+} // namespace apns
@@ -0,0 +1,536 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** HAL9000, Internet Relay Chat Bot                                     **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: APNS.cpp,v 1.12 2003/09/05 22:23:41 omni Exp $
+ **************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <openframe/openframe.h>
+
+#include "apns.h"
+#include "MockGateway.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** MockGateway Class                                                    **
+ **************************************************************************/
+  static const int MOCK_POLL_INTERVAL		= 100;		// ms between checks for stop()
+  static const size_t MOCK_READ_SIZE		= 16384;
+  static const size_t MOCK_SIMPLE_HEADER	= 1 + 2;
+  static const size_t MOCK_ENHANCED_HEADER	= 1 + 4 + 4 + 2;
+
+  MockGateway::MockGateway(const MockGatewayOptions &options) : _options(options) {
+    _ctx = NULL;
+    _pushFd = -1;
+    _feedbackFd = -1;
+    _pushPort = 0;
+    _feedbackPort = 0;
+    _running = false;
+    _stopping = false;
+    _numConnections = 0;
+    _numFrames = 0;
+    _numBytes = 0;
+    _numErrors = 0;
+    _numDrops = 0;
+    _numFeedback = 0;
+
+    pthread_mutex_init(&_mutex, NULL);
+
+    return;
+  } // MockGateway::MockGateway
+
+  MockGateway::~MockGateway() {
+    stop();
+
+    pthread_mutex_destroy(&_mutex);
+
+    return;
+  } // MockGateway::~MockGateway
+
+  void MockGateway::start() {
+    char errmsg[256];
+
+    if (_running)
+      return;
+
+    _ctx = SSL_CTX_new(TLS_server_method());
+    if (_ctx == NULL)
+      throw MockGateway_Exception("Could not create SSL context.");
+
+    if (SSL_CTX_use_certificate_chain_file(_ctx, _options.certfile.c_str()) <= 0
+        || SSL_CTX_use_PrivateKey_file(_ctx, _options.keyfile.c_str(), SSL_FILETYPE_PEM) <= 0) {
+      ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+      stop();
+      throw MockGateway_Exception("Could not load " + _options.certfile + ": " + errmsg);
+    } // if
+
+    if (_options.cafile.length()) {
+      if (SSL_CTX_load_verify_locations(_ctx, _options.cafile.c_str(), NULL) <= 0) {
+        stop();
+        throw MockGateway_Exception("Could not load " + _options.cafile);
+      } // if
+
+      SSL_CTX_set_verify(_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    } // if
+
+    _pushPort = _options.pushPort;
+    _feedbackPort = _options.feedbackPort;
+    _pushFd = _listen(_pushPort);
+    _feedbackFd = _listen(_feedbackPort);
+    if (_pushFd == -1 || _feedbackFd == -1) {
+      snprintf(errmsg, sizeof(errmsg), "%s", strerror(errno));
+      stop();
+      throw MockGateway_Exception(std::string("Could not listen on ") + _options.host + ": " + errmsg);
+    } // if
+
+    _stopping = false;
+    if (pthread_create(&_acceptThreadId, NULL, _acceptThread, this) != 0) {
+      stop();
+      throw MockGateway_Exception("Could not start accept thread.");
+    } // if
+
+    _running = true;
+  } // MockGateway::start
+
+  void MockGateway::stop() {
+    std::vector<pthread_t> threads;
+    size_t i;
+
+    _stopping = true;
+
+    if (_running) {
+      pthread_join(_acceptThreadId, NULL);
+      _running = false;
+    } // if
+
+    // nothing adds to _threads once the accept thread is gone
+    pthread_mutex_lock(&_mutex);
+    threads.swap(_threads);
+    pthread_mutex_unlock(&_mutex);
+
+    for(i = 0; i < threads.size(); i++)
+      pthread_join(threads[i], NULL);
+
+    if (_pushFd != -1)
+      close(_pushFd);
+    if (_feedbackFd != -1)
+      close(_feedbackFd);
+    _pushFd = -1;
+    _feedbackFd = -1;
+
+    if (_ctx != NULL)
+      SSL_CTX_free(_ctx);
+    _ctx = NULL;
+  } // MockGateway::stop
+
+  // Feedback records are |time 4|token length 2|token 32|, big endian.
+  void MockGateway::addFeedback(const std::string &deviceToken, const time_t ts) {
+    unsigned char record[4 + 2 + DEVICE_BINARY_SIZE];
+    uint32_t networkOrderTs = htonl((uint32_t) ts);
+    uint16_t networkOrderTokenLength = htons(DEVICE_BINARY_SIZE);
+    unsigned int tmpi;
+    size_t i, j;
+
+    memset(record, '\0', sizeof(record));
+    memcpy(record, &networkOrderTs, sizeof(uint32_t));
+    memcpy(record + 4, &networkOrderTokenLength, sizeof(uint16_t));
+
+    for(i = 0, j = 0; i + 1 < deviceToken.length() && j < DEVICE_BINARY_SIZE; ) {
+      if (deviceToken[i] == ' ') {
+        i++;
+        continue;
+      } // if
+
+      if (sscanf(deviceToken.substr(i, 2).c_str(), "%2x", &tmpi) != 1)
+        throw MockGateway_Exception("Invalid device token " + deviceToken);
+
+      record[6 + j++] = tmpi;
+      i += 2;
+    } // for
+
+    pthread_mutex_lock(&_mutex);
+    _feedback.append((const char *) record, sizeof(record));
+    pthread_mutex_unlock(&_mutex);
+  } // MockGateway::addFeedback
+
+  const int MockGateway::_listen(int &port) {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int on = 1;
+    int fd;
+
+    memset(&addr, '\0', sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, _options.host.c_str(), &addr.sin_addr) != 1) {
+      errno = EINVAL;
+      return -1;
+    } // if
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == -1)
+      return -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(fd, 64) == -1
+        || getsockname(fd, (struct sockaddr *) &addr, &addrlen) == -1) {
+      close(fd);
+      return -1;
+    } // if
+
+    port = ntohs(addr.sin_port);
+
+    return fd;
+  } // MockGateway::_listen
+
+  void *MockGateway::_acceptThread(void *arg) {
+    MockGateway *gateway = (MockGateway *) arg;
+    struct pollfd pfd[2];
+
+    pfd[0].fd = gateway->_pushFd;
+    pfd[1].fd = gateway->_feedbackFd;
+    pfd[0].events = pfd[1].events = POLLIN;
+
+    while(!gateway->_stopping) {
+      pfd[0].revents = pfd[1].revents = 0;
+      if (poll(pfd, 2, MOCK_POLL_INTERVAL) < 1)
+        continue;
+
+      if (pfd[0].revents & POLLIN)
+        gateway->_accept(pfd[0].fd, false);
+
+      if (pfd[1].revents & POLLIN)
+        gateway->_accept(pfd[1].fd, true);
+    } // while
+
+    return NULL;
+  } // MockGateway::_acceptThread
+
+  void MockGateway::_accept(const int listenFd, const bool feedback) {
+    MockGateway_Connection *conn;
+    pthread_t thread;
+    int fd;
+
+    fd = accept(listenFd, NULL, NULL);
+    if (fd == -1)
+      return;
+
+    conn = new MockGateway_Connection;
+    conn->gateway = this;
+    conn->fd = fd;
+    conn->feedback = feedback;
+    conn->seed = _options.seed + __sync_fetch_and_add(&_numConnections, 1);
+
+    if (pthread_create(&thread, NULL, _connectionThread, conn) != 0) {
+      close(fd);
+      delete conn;
+      return;
+    } // if
+
+    pthread_mutex_lock(&_mutex);
+    _threads.push_back(thread);
+    pthread_mutex_unlock(&_mutex);
+  } // MockGateway::_accept
+
+  void *MockGateway::_connectionThread(void *arg) {
+    MockGateway_Connection *conn = (MockGateway_Connection *) arg;
+    MockGateway *gateway = conn->gateway;
+    SSL *ssl;
+
+    ssl = gateway->_handshake(conn->fd);
+    if (ssl != NULL) {
+      if (conn->feedback)
+        gateway->_serveFeedback(ssl);
+      else
+        gateway->_servePush(ssl, conn->seed);
+
+      SSL_shutdown(ssl);
+      SSL_free(ssl);
+    } // if
+
+    close(conn->fd);
+    delete conn;
+
+    return NULL;
+  } // MockGateway::_connectionThread
+
+  // Reads on the connection time out so a client that goes quiet
+  // mid-record can't hold up stop().
+  SSL *MockGateway::_handshake(const int fd) {
+    struct timeval timeout = {0, MOCK_POLL_INTERVAL * 1000};
+    SSL *ssl;
+    int ret;
+
+    if (!_sleep(_options.latency))
+      return NULL;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ssl = SSL_new(_ctx);
+    if (ssl == NULL)
+      return NULL;
+
+    SSL_set_fd(ssl, fd);
+
+    while((ret = SSL_accept(ssl)) != 1) {
+      if (_stopping || SSL_get_error(ssl, ret) != SSL_ERROR_WANT_READ) {
+        SSL_free(ssl);
+        return NULL;
+      } // if
+    } // while
+
+    return ssl;
+  } // MockGateway::_handshake
+
+  void MockGateway::_servePush(SSL *ssl, unsigned int seed) {
+    const uint64_t startUs = LatencyHistogram::now();
+    std::string buffer;
+    std::string deviceToken;
+    std::map<std::string, unsigned char>::const_iterator ptr;
+    unsigned long long numBytes = 0;
+    unsigned int numFrames = 0;
+    bool stalled = false;
+    char chunk[MOCK_READ_SIZE];
+    struct pollfd pfd;
+    uint32_t identifier;
+    size_t want;
+    int ret;
+
+    pfd.fd = SSL_get_fd(ssl);
+    pfd.events = POLLIN;
+
+    while(_throttle(startUs, numBytes, want)) {
+      if (!SSL_pending(ssl)) {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, MOCK_POLL_INTERVAL) < 1)
+          continue;
+      } // if
+
+      ret = SSL_read(ssl, chunk, want < sizeof(chunk) ? want : sizeof(chunk));
+      if (ret < 1 && SSL_get_error(ssl, ret) == SSL_ERROR_WANT_READ)
+        continue;
+      if (ret < 1)
+        return;
+
+      numBytes += ret;
+      __sync_fetch_and_add(&_numBytes, ret);
+      buffer.append(chunk, ret);
+
+      while((ret = _parseFrame((const unsigned char *) buffer.data(), buffer.length(), identifier, deviceToken)) > 0) {
+        buffer.erase(0, ret);
+        numFrames++;
+        __sync_fetch_and_add(&_numFrames, 1);
+
+        ptr = _options.errorTokens.find(deviceToken);
+        if (ptr != _options.errorTokens.end()) {
+          _reject(ssl, ptr->second, identifier);
+          return;
+        } // if
+
+        if (_options.errorRate > 0 && rand_r(&seed) < _options.errorRate * RAND_MAX) {
+          _reject(ssl, _options.errorStatus, identifier);
+          return;
+        } // if
+
+        if ((_options.dropAfterFrames && numFrames >= _options.dropAfterFrames)
+            || (_options.dropRate > 0 && rand_r(&seed) < _options.dropRate * RAND_MAX)) {
+          _drop(ssl);
+          return;
+        } // if
+
+        if (!stalled && _options.stallAfterFrames && numFrames >= _options.stallAfterFrames) {
+          stalled = true;
+          if (!_sleep(_options.stallTime))
+            return;
+        } // if
+      } // while
+
+      if (ret < 0) {
+        _reject(ssl, PushController::ERR_PROCESSING_ERROR, 0);
+        return;
+      } // if
+    } // while
+  } // MockGateway::_servePush
+
+  // Returns the length of the first frame in buf, 0 if it isn't all
+  // there yet or -1 for a command we don't speak.
+  //
+  //   simple:   |0|token length 2|token|payload length 2|payload|
+  //   enhanced: |1|identifier 4|expiry 4|token length 2|token|payload length 2|payload|
+  const int MockGateway::_parseFrame(const unsigned char *buf, const size_t len, uint32_t &identifier, std::string &deviceToken) {
+    static const char hex[] = "0123456789abcdef";
+    size_t header;
+    uint16_t tokenLen;
+    uint16_t payloadLen;
+    size_t i;
+
+    if (!len)
+      return 0;
+
+    if (buf[0] == PushController::COMMAND_PUSH_SIMPLE)
+      header = MOCK_SIMPLE_HEADER;
+    else if (buf[0] == PushController::COMMAND_PUSH_ENHANCED)
+      header = MOCK_ENHANCED_HEADER;
+    else
+      return -1;
+
+    if (len < header)
+      return 0;
+
+    memcpy(&tokenLen, buf + header - 2, sizeof(uint16_t));
+    tokenLen = ntohs(tokenLen);
+
+    if (len < header + tokenLen + 2)
+      return 0;
+
+    memcpy(&payloadLen, buf + header + tokenLen, sizeof(uint16_t));
+    payloadLen = ntohs(payloadLen);
+
+    if (len < header + tokenLen + 2 + payloadLen)
+      return 0;
+
+    identifier = 0;
+    if (buf[0] == PushController::COMMAND_PUSH_ENHANCED) {
+      memcpy(&identifier, buf + 1, sizeof(uint32_t));
+      identifier = ntohl(identifier);
+    } // if
+
+    deviceToken.resize(tokenLen * 2);
+    for(i = 0; i < tokenLen; i++) {
+      deviceToken[i * 2] = hex[buf[header + i] >> 4];
+      deviceToken[i * 2 + 1] = hex[buf[header + i] & 0x0f];
+    } // for
+
+    return header + tokenLen + 2 + payloadLen;
+  } // MockGateway::_parseFrame
+
+  // Hang up the way a dead path looks: no close_notify, just a reset.
+  void MockGateway::_drop(SSL *ssl) {
+    struct linger linger = {1, 0};
+
+    setsockopt(SSL_get_fd(ssl), SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    SSL_set_quiet_shutdown(ssl, 1);
+
+    __sync_fetch_and_add(&_numDrops, 1);
+  } // MockGateway::_drop
+
+  // |8|status|identifier 4|, after which APNs hangs up.
+  const bool MockGateway::_reject(SSL *ssl, const unsigned char status, const uint32_t identifier) {
+    unsigned char response[6];
+    uint32_t networkOrderIdentifier = htonl(identifier);
+
+    response[0] = PushController::ERROR_RESPONSE_COMMAND;
+    response[1] = status;
+    memcpy(response + 2, &networkOrderIdentifier, sizeof(uint32_t));
+
+    __sync_fetch_and_add(&_numErrors, 1);
+
+    if (!_sleep(_options.latency))
+      return false;
+
+    return SSL_write(ssl, response, sizeof(response)) == sizeof(response);
+  } // MockGateway::_reject
+
+  void MockGateway::_serveFeedback(SSL *ssl) {
+    const uint64_t startUs = LatencyHistogram::now();
+    std::string feedback;
+    size_t offset = 0;
+    size_t want;
+    int ret;
+
+    pthread_mutex_lock(&_mutex);
+    feedback.swap(_feedback);
+    pthread_mutex_unlock(&_mutex);
+
+    while(offset < feedback.length() && _throttle(startUs, offset, want)) {
+      if (want > feedback.length() - offset)
+        want = feedback.length() - offset;
+
+      ret = SSL_write(ssl, feedback.data() + offset, want);
+      if (ret < 1)
+        break;
+
+      offset += ret;
+    } // while
+
+    __sync_fetch_and_add(&_numFeedback, offset / (4 + 2 + DEVICE_BINARY_SIZE));
+  } // MockGateway::_serveFeedback
+
+  // How many bytes the connection may move now under bytesPerSecond,
+  // waiting until it is at least one; false once stop() was called.
+  const bool MockGateway::_throttle(const uint64_t startUs, const unsigned long long done, size_t &want) {
+    unsigned long long allowed;
+
+    while(!_stopping) {
+      if (!_options.bytesPerSecond) {
+        want = MOCK_READ_SIZE;
+        return true;
+      } // if
+
+      allowed = (LatencyHistogram::now() - startUs) * _options.bytesPerSecond / 1000000;
+      if (allowed > done) {
+        want = allowed - done < MOCK_READ_SIZE ? allowed - done : MOCK_READ_SIZE;
+        return true;
+      } // if
+
+      usleep(1000);
+    } // while
+
+    return false;
+  } // MockGateway::_throttle
+
+  // Sleeps in slices so stop() isn't held up; false if it was called.
+  const bool MockGateway::_sleep(const unsigned int msec) {
+    unsigned int slept = 0;
+    unsigned int slice;
+
+    while(slept < msec && !_stopping) {
+      slice = msec - slept < (unsigned int) MOCK_POLL_INTERVAL ? msec - slept : MOCK_POLL_INTERVAL;
+      usleep(slice * 1000);
+      slept += slice;
+    } // while
+
+    return !_stopping;
+  } // MockGateway::_sleep
+} // namespace apns
@@ -0,0 +1,171 @@
+/**************************************************************************
+ ** Dynamic Networking Solutions                                         **
+ **************************************************************************
+ ** OpenAPRS, mySQL APRS Injector                                        **
+ ** Copyright (C) 1999 Gregory A. Carter                                 **
+ **                    Daniel Robert Karrels                             **
+ **                    Dynamic Networking Solutions                      **
+ **                                                                      **
+ ** This program is free software; you can redistribute it and/or modify **
+ ** it under the terms of the GNU General Public License as published by **
+ ** the Free Software Foundation; either version 1, or (at your option)  **
+ ** any later version.                                                   **
+ **                                                                      **
+ ** This program is distributed in the hope that it will be useful,      **
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of       **
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        **
+ ** GNU General Public License for more details.                         **
+ **                                                                      **
+ ** You should have received a copy of the GNU General Public License    **
+ ** along with this program; if not, write to the Free Software          **
+ ** Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.            **
+ **************************************************************************
+ $Id: DCC.h,v 1.8 2003/09/04 00:22:00 omni Exp $
+ **************************************************************************/
+
+#ifndef LIBAPNS_MOCKGATEWAY_H
+#define LIBAPNS_MOCKGATEWAY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+
+#include "ApnsAbstract.h"
+
+namespace apns {
+
+/**************************************************************************
+ ** General Defines                                                      **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Structures                                                           **
+ **************************************************************************/
+
+  class MockGateway_Exception : public ApnsAbstract_Exception {
+    public:
+      MockGateway_Exception(const std::string message) throw() : ApnsAbstract_Exception(message) { };
+  }; // class MockGateway_Exception
+
+  // How the mock misbehaves; the defaults accept everything as fast as
+  // the loopback allows.  Random choices are drawn from seed, so a run
+  // can be repeated.
+  struct MockGatewayOptions {
+    MockGatewayOptions() : host("127.0.0.1"), pushPort(0), feedbackPort(0),
+      latency(0), bytesPerSecond(0), stallAfterFrames(0), stallTime(0),
+      dropAfterFrames(0), dropRate(0), errorRate(0), errorStatus(8), seed(1) { }
+
+    std::string host;			// address to listen on
+    int pushPort;			// 0 picks a free port, see pushPort()
+    int feedbackPort;			// 0 picks a free port, see feedbackPort()
+    std::string certfile;		// server certificate
+    std::string keyfile;		// and its key
+    std::string cafile;			// if set, clients must present a cert it signed
+    unsigned int latency;		// ms before each handshake and error response
+    unsigned int bytesPerSecond;	// read (and feedback write) rate cap per connection
+    unsigned int stallAfterFrames;	// stop reading after this many frames...
+    unsigned int stallTime;		// ...for this many ms, once per connection
+    unsigned int dropAfterFrames;	// hang up silently after this many frames
+    double dropRate;			// chance any frame hangs up silently
+    double errorRate;			// chance any frame is rejected with errorStatus
+    unsigned char errorStatus;		// status for errorRate rejections
+    std::map<std::string, unsigned char> errorTokens;	// hex token to status, always rejected
+    unsigned int seed;			// for errorRate and dropRate
+  }; // MockGatewayOptions
+
+  // A local stand in for the APNs binary gateway and feedback service,
+  // for tests and benchmarks on a machine without network.  The push
+  // port reads simple and enhanced frames and answers the way APNs does:
+  // silence for accepted frames, an error response then a hang up for
+  // rejected ones.  Each feedback connection is sent whatever records
+  // were queued with addFeedback() since the last one and closed.
+  //
+  // start() listens (throwing MockGateway_Exception if it can't) and
+  // serves from a background thread, one more per connection; stop() or
+  // the destructor closes everything and joins.  As with the library
+  // itself, SIGPIPE should be ignored by the process.
+  class MockGateway {
+    public:
+      MockGateway(const MockGatewayOptions &);
+      virtual ~MockGateway();
+
+      /***************
+       ** Variables **
+       ***************/
+      void start();
+      void stop();
+      const inline bool isRunning() const { return _running; }
+
+      const inline int pushPort() const { return _pushPort; }
+      const inline int feedbackPort() const { return _feedbackPort; }
+      const inline MockGatewayOptions &options() const { return _options; }
+
+      // queue a record for the next feedback connection
+      void addFeedback(const std::string &, const time_t);
+
+      const unsigned int numConnections() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_numConnections), 0); }
+      const unsigned int numFrames() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_numFrames), 0); }
+      const unsigned long long numBytes() const { return __sync_fetch_and_add(const_cast<unsigned long long *>(&_numBytes), 0); }
+      const unsigned int numErrors() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_numErrors), 0); }
+      const unsigned int numDrops() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_numDrops), 0); }
+      const unsigned int numFeedback() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_numFeedback), 0); }
+
+    protected:
+    private:
+      typedef struct {
+        MockGateway *gateway;
+        int fd;
+        bool feedback;
+        unsigned int seed;
+      } MockGateway_Connection;
+
+      static void *_acceptThread(void *);
+      static void *_connectionThread(void *);
+
+      const int _listen(int &);
+      void _accept(const int, const bool);
+      SSL *_handshake(const int);
+      void _servePush(SSL *, unsigned int);
+      void _serveFeedback(SSL *);
+      const int _parseFrame(const unsigned char *, const size_t, uint32_t &, std::string &);
+      const bool _reject(SSL *, const unsigned char, const uint32_t);
+      void _drop(SSL *);
+      const bool _throttle(const uint64_t, const unsigned long long, size_t &);
+      const bool _sleep(const unsigned int);
+
+      // *** Variables ***
+      MockGatewayOptions _options;
+      SSL_CTX *_ctx;
+      int _pushFd;				// listening sockets
+      int _feedbackFd;
+      int _pushPort;				// ports actually bound
+      int _feedbackPort;
+      volatile bool _running;
+      volatile bool _stopping;
+      pthread_t _acceptThreadId;
+      pthread_mutex_t _mutex;			// guards _threads and _feedback
+      std::vector<pthread_t> _threads;		// connection threads, joined by stop()
+      std::string _feedback;			// encoded records for the next feedback connection
+      unsigned int _numConnections;
+      unsigned int _numFrames;
+      unsigned long long _numBytes;
+      unsigned int _numErrors;
+      unsigned int _numDrops;
+      unsigned int _numFeedback;
+  }; // MockGateway
+
+/**************************************************************************
+ ** Macro's                                                              **
+ **************************************************************************/
+
+/**************************************************************************
+ ** Proto types                                                          **
+ **************************************************************************/
+} // namespace apns
+#endif
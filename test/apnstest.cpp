@@ -3,16 +3,367 @@
 #include <iostream>
 #include <new>
 #include <string>
+#include <vector>
 
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include <openframe/openframe.h>
 
+#include "apns.h"
+#include "MockGateway.h"
+
+// Push the same amount of data through a connection with userspace
+// SSL_write and again with kernel TLS, printing the throughput of each.
+//
+//   apnstest ktls-bench <host> <port> <certfile> <keyfile> <capath> [megabytes]
+//
+// Any TLS sink will do, e.g. openssl s_server -quiet > /dev/null.
+static const double benchThroughput(apns::SslController &ssl, const size_t numBytes, bool &kernelSend) {
+  struct timeval start, end;
+  struct pollfd pfd;
+  char chunk[16384];
+  size_t sent = 0;
+
+  memset(chunk, 'x', sizeof(chunk));
+
+  while(!ssl.connect()) {
+    if (!ssl.isConnecting())
+      return -1;
+    usleep(1000);
+  } // while
+
+  // byte counters run across connections
+  const unsigned long long base = ssl.bytesFlushed();
+
+  kernelSend = ssl.isKernelTlsSend();
+  gettimeofday(&start, NULL);
+
+  while(ssl.isConnected() && ssl.bytesFlushed() - base < numBytes) {
+    while(sent < numBytes && ssl.pendingBytes() < 4 * sizeof(chunk)) {
+      ssl.bufferWrite(chunk, sizeof(chunk));
+      sent += sizeof(chunk);
+    } // while
+
+    if (ssl.flush() < 0)
+      return -1;
+
+    if (ssl.pendingBytes()) {
+      pfd.fd = ssl.fd();
+      pfd.events = ssl.pollEvents();
+      poll(&pfd, 1, 100);
+    } // if
+  } // while
+
+  gettimeofday(&end, NULL);
+
+  ssl.disconnect();
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  return elapsed > 0 ? (numBytes / 1048576.0) / elapsed : 0;
+} // benchThroughput
+
+static int benchKernelTls(int argc, char **argv) {
+  if (argc < 7) {
+    std::cerr << "usage: " << argv[0] << " ktls-bench <host> <port> <certfile> <keyfile> <capath> [megabytes]" << std::endl;
+    return 1;
+  } // if
+
+  size_t numBytes = (argc > 7 ? atoi(argv[7]) : 256) * 1048576UL;
+  apns::SslController ssl(argv[2], atoi(argv[3]), argv[4], argv[5], argv[6]);
+
+  bool kernelSend;
+
+  double userspace = benchThroughput(ssl, numBytes, kernelSend);
+
+  ssl.kernelTls(true);
+  double kernel = benchThroughput(ssl, numBytes, kernelSend);
+
+  std::cout << "userspace SSL_write: " << userspace << " MB/s" << std::endl;
+  std::cout << "kernel tls:          " << kernel << " MB/s"
+            << (kernelSend ? "" : " (kTLS unavailable, fell back to userspace)")
+            << std::endl;
+
+  return userspace < 0 || kernel < 0;
+} // benchKernelTls
+
+static int dumpFeedbackLog(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " feedback-dump <logfile> [count]" << std::endl;
+    return 1;
+  } // if
+
+  try {
+    apns::FeedbackLogReader reader(argv[2]);
+    apns::FeedbackRecord record;
+    size_t count = argc > 3 ? atoi(argv[3]) : reader.size();
+    char hex[3];
+
+    std::cout << reader.size() << " records" << std::endl;
+
+    for(size_t i = 0; i < count && i < reader.size(); i++) {
+      reader.record(i, record);
+
+      std::cout << record.timestamp << " ";
+      for(size_t j = 0; j < DEVICE_BINARY_SIZE; j++) {
+        snprintf(hex, sizeof(hex), "%02x", record.deviceToken[j]);
+        std::cout << hex;
+      } // for
+      std::cout << std::endl;
+    } // for
+  } // try
+  catch(apns::FeedbackLog_Exception &e) {
+    std::cerr << e.message() << std::endl;
+    return 1;
+  } // catch
+
+  return 0;
+} // dumpFeedbackLog
+
+// Options shared by mock-gateway and mock-bench, given as name=value
+// after the fixed arguments.  Certificates come from gencerts.sh.
+static const bool parseMockOptions(int argc, char **argv, int first, const std::string &certdir, apns::MockGatewayOptions &options, std::vector<std::string> &feedback) {
+  options.certfile = certdir + "/server.pem";
+  options.keyfile = certdir + "/server.key";
+
+  for(int i = first; i < argc; i++) {
+    std::string arg = argv[i];
+    std::string::size_type pos = arg.find('=');
+
+    if (pos == std::string::npos) {
+      std::cerr << "expected name=value, got " << arg << std::endl;
+      return false;
+    } // if
+
+    std::string name = arg.substr(0, pos);
+    std::string value = arg.substr(pos + 1);
+
+    if (name == "push-port")
+      options.pushPort = atoi(value.c_str());
+    else if (name == "feedback-port")
+      options.feedbackPort = atoi(value.c_str());
+    else if (name == "require-client-cert")
+      options.cafile = atoi(value.c_str()) ? certdir + "/ca.pem" : "";
+    else if (name == "latency")
+      options.latency = atoi(value.c_str());
+    else if (name == "rate")
+      options.bytesPerSecond = atoi(value.c_str());
+    else if (name == "stall-after")
+      options.stallAfterFrames = atoi(value.c_str());
+    else if (name == "stall")
+      options.stallTime = atoi(value.c_str());
+    else if (name == "drop-after")
+      options.dropAfterFrames = atoi(value.c_str());
+    else if (name == "drop-rate")
+      options.dropRate = atof(value.c_str());
+    else if (name == "error-rate")
+      options.errorRate = atof(value.c_str());
+    else if (name == "error-status")
+      options.errorStatus = atoi(value.c_str());
+    else if (name == "error-token" && value.find(':') != std::string::npos)
+      options.errorTokens[value.substr(0, value.find(':'))] = atoi(value.substr(value.find(':') + 1).c_str());
+    else if (name == "feedback")
+      feedback.push_back(value);
+    else if (name == "seed")
+      options.seed = atoi(value.c_str());
+    else {
+      std::cerr << "unknown option " << name << std::endl;
+      return false;
+    } // else
+  } // for
+
+  return true;
+} // parseMockOptions
+
+static void printMockStats(const apns::MockGateway &gateway) {
+  std::cout << "connections(" << gateway.numConnections()
+            << ") frames(" << gateway.numFrames()
+            << ") bytes(" << gateway.numBytes()
+            << ") errors(" << gateway.numErrors()
+            << ") drops(" << gateway.numDrops()
+            << ") feedback(" << gateway.numFeedback()
+            << ")" << std::endl;
+} // printMockStats
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void stopMockGateway(int) {
+  s_stop = 1;
+} // stopMockGateway
+
+// Run a mock APNs gateway and feedback service until interrupted.
+//
+//   apnstest mock-gateway <certdir> [name=value ...]
+//
+// e.g. error-rate=0.01 drop-after=500 latency=20 feedback=<token>
+static int runMockGateway(int argc, char **argv) {
+  apns::MockGatewayOptions options;
+  std::vector<std::string> feedback;
+
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " mock-gateway <certdir> [name=value ...]" << std::endl;
+    return 1;
+  } // if
+
+  if (!parseMockOptions(argc, argv, 3, argv[2], options, feedback))
+    return 1;
+
+  apns::MockGateway gateway(options);
+
+  try {
+    gateway.start();
+    for(size_t i = 0; i < feedback.size(); i++)
+      gateway.addFeedback(feedback[i], time(NULL));
+  } // try
+  catch(apns::MockGateway_Exception &e) {
+    std::cerr << e.message() << std::endl;
+    return 1;
+  } // catch
+
+  std::cout << "push on " << options.host << ":" << gateway.pushPort()
+            << ", feedback on " << options.host << ":" << gateway.feedbackPort()
+            << std::endl;
+
+  signal(SIGINT, stopMockGateway);
+  signal(SIGTERM, stopMockGateway);
+
+  while(!s_stop)
+    sleep(1);
+
+  gateway.stop();
+  printMockStats(gateway);
+
+  return 0;
+} // runMockGateway
+
+class BenchOutcomes : public apns::PushOutcomeHandler {
+  public:
+    BenchOutcomes() { memset(count, '\0', sizeof(count)); }
+    void onOutcomes(const apns::PushOutcome *outcomes, const size_t num) {
+      for(size_t i = 0; i < num; i++)
+        count[outcomes[i].outcome]++;
+    } // onOutcomes
+
+    unsigned int count[apns::OUTCOME_DROPPED + 1];
+}; // BenchOutcomes
+
+// Push messages through the library to an in-process mock gateway,
+// then poll its feedback service, printing what each side saw.
+//
+//   apnstest mock-bench <certdir> [messages] [name=value ...]
+static int benchMockGateway(int argc, char **argv) {
+  apns::MockGatewayOptions options;
+  std::vector<std::string> feedback;
+  BenchOutcomes outcomes;
+  struct timeval start, end;
+  std::string certdir;
+
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " mock-bench <certdir> [messages] [name=value ...]" << std::endl;
+    return 1;
+  } // if
+
+  certdir = argv[2];
+  const unsigned int numMessages = argc > 3 ? atoi(argv[3]) : 10000;
+
+  if (!parseMockOptions(argc, argv, 4, certdir, options, feedback))
+    return 1;
+
+  apns::MockGateway gateway(options);
+
+  try {
+    gateway.start();
+  } // try
+  catch(apns::MockGateway_Exception &e) {
+    std::cerr << e.message() << std::endl;
+    return 1;
+  } // catch
+
+  {
+    apns::PushController push("127.0.0.1", gateway.pushPort(), certdir + "/client.pem", certdir + "/client.key", certdir, 60);
+    apns::PushController::messageQueueType unsent;
+
+    push.outcomeHandler(&outcomes);
+
+    gettimeofday(&start, NULL);
+
+    for(unsigned int i = 0; i < numMessages; i++) {
+      apns::ApnsMessage *aMessage = new apns::ApnsMessage(push.generateRandomDeviceToken());
+      aMessage->text("mock bench");
+      push.add(aMessage);
+
+      // the first hundred tokens come back as feedback
+      if (i < 100)
+        gateway.addFeedback(aMessage->deviceToken(), time(NULL));
+    } // for
+
+    push.drain(time(NULL) + 60, unsent);
+
+    gettimeofday(&end, NULL);
+
+    for(apns::PushController::messageQueueType::iterator ptr = unsent.begin(); ptr != unsent.end(); ptr++)
+      delete *ptr;
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    std::cout << numMessages << " messages in " << elapsed << "s, "
+              << (elapsed > 0 ? numMessages / elapsed : 0) << " msg/s, "
+              << unsent.size() << " unsent" << std::endl;
+    std::cout << "queue latency " << push.queueLatency().summary() << std::endl;
+    std::cout << "connect latency " << push.connectLatency().summary() << std::endl;
+  } // push
+
+  std::cout << "outcomes: sent(" << outcomes.count[apns::OUTCOME_SENT]
+            << ") failed(" << outcomes.count[apns::OUTCOME_FAILED]
+            << ") expired(" << outcomes.count[apns::OUTCOME_EXPIRED]
+            << ") retries-exhausted(" << outcomes.count[apns::OUTCOME_RETRIES_EXHAUSTED]
+            << ") dropped(" << outcomes.count[apns::OUTCOME_DROPPED]
+            << ")" << std::endl;
+
+  {
+    apns::FeedbackController fb("127.0.0.1", gateway.feedbackPort(), certdir + "/client.pem", certdir + "/client.key", certdir, 1);
+    apns::FeedbackController::messageQueueType records;
+
+    for(time_t until = time(NULL) + 10; !fb.lastPollRecords() && time(NULL) < until; ) {
+      fb.run();
+      usleep(1000);
+    } // for
+
+    fb.getQueue(records);
+    std::cout << "feedback records " << records.size()
+              << ", poll latency " << fb.pollLatency().summary() << std::endl;
+
+    for(apns::FeedbackController::messageQueueType::iterator ptr = records.begin(); ptr != records.end(); ptr++)
+      delete *ptr;
+  } // feedback
+
+  gateway.stop();
+  printMockStats(gateway);
+
+  return 0;
+} // benchMockGateway
+
 int main(int argc, char **argv) {
 
+  if (argc > 1 && !strcmp(argv[1], "ktls-bench"))
+    return benchKernelTls(argc, argv);
+
+  if (argc > 1 && !strcmp(argv[1], "feedback-dump"))
+    return dumpFeedbackLog(argc, argv);
+
+  // a peer hanging up on SSL_write must not take the process with it
+  signal(SIGPIPE, SIG_IGN);
+
+  if (argc > 1 && !strcmp(argv[1], "mock-gateway"))
+    return runMockGateway(argc, argv);
+
+  if (argc > 1 && !strcmp(argv[1], "mock-bench"))
+    return benchMockGateway(argc, argv);
+
   return 0;
 } // main
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Generate a throwaway CA, a server certificate for localhost and a
+# client certificate for MockGateway tests; nothing here is trusted by
+# anything else.
+#
+#   ./gencerts.sh [directory]
+#
+# The directory is also hashed so it can be handed to the library as a
+# capath.
+
+dir=${1:-certs}
+days=3650
+
+set -e
+mkdir -p "$dir"
+cd "$dir"
+
+openssl req -x509 -newkey rsa:2048 -nodes -days $days \
+  -subj "/CN=apnstest CA" -keyout ca.key -out ca.pem 2>/dev/null
+
+for name in server client; do
+  if [ $name = server ]; then cn=localhost; else cn=apnstest; fi
+
+  openssl req -newkey rsa:2048 -nodes \
+    -subj "/CN=$cn" -keyout $name.key -out $name.csr 2>/dev/null
+  printf "subjectAltName=DNS:localhost,IP:127.0.0.1\n" > $name.ext
+  openssl x509 -req -in $name.csr -CA ca.pem -CAkey ca.key -CAcreateserial \
+    -days $days -extfile $name.ext -out $name.pem 2>/dev/null
+  rm -f $name.csr $name.ext
+done
+
+openssl rehash . 2>/dev/null || c_rehash . >/dev/null
+
+echo "certificates written to $dir"
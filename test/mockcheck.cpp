@@ -0,0 +1,161 @@
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <openframe/openframe.h>
+
+#include "apns.h"
+#include "MockGateway.h"
+
+// Pushes messages through PushController to an in-process MockGateway
+// under injected faults and checks that every message added is
+// accounted for exactly once.  Run by make check through mockcheck.sh,
+// which supplies the certificates.
+//
+//   mockcheck <certdir>
+
+class CheckOutcomes : public apns::PushOutcomeHandler {
+  public:
+    CheckOutcomes() : total(0) { memset(count, '\0', sizeof(count)); }
+    void onOutcomes(const apns::PushOutcome *outcomes, const size_t num) {
+      for(size_t i = 0; i < num; i++)
+        count[outcomes[i].outcome]++;
+      total += num;
+    } // onOutcomes
+
+    unsigned int count[apns::OUTCOME_DROPPED + 1];
+    unsigned int total;
+}; // CheckOutcomes
+
+static bool s_failed = false;
+
+static void expect(const std::string &name, const bool ok, const std::string &what) {
+  if (ok)
+    return;
+
+  std::cerr << "FAIL " << name << ": " << what << std::endl;
+  s_failed = true;
+} // expect
+
+// Every message ends as sent, failed or out of retries.  An error
+// response is its own frame failing, which is final, and requeues what
+// followed it uncharged; a hang up charges a retry to what it cut off.
+// With no rejections every resend is charged, so the gateway can't have
+// seen more than maxRetries + 1 frames per message.  Each error the
+// gateway sends should fail exactly one message; an error token is
+// rejected on every resend, so one whose response went missing would
+// show up as an extra error.
+static void checkRun(const std::string &certdir, const std::string &name, apns::MockGatewayOptions options, const unsigned int numMessages, const unsigned int numErrorTokens, const unsigned int maxRetries = apns::ApnsMessage::DEFAULT_MAXIMUM_RETRIES) {
+  CheckOutcomes outcomes;
+  std::vector<std::string> errorTokens;
+  apns::PushController::messageQueueType unsent;
+
+  options.certfile = certdir + "/server.pem";
+  options.keyfile = certdir + "/server.key";
+
+  for(unsigned int i = 0; i < numErrorTokens; i++) {
+    std::string token = apns::ApnsAbstract().generateRandomDeviceToken();
+    for(size_t j = 0; j < token.length(); j++)
+      token[j] = tolower(token[j]);
+    options.errorTokens[token] = apns::PushController::ERR_INVALID_TOKEN;
+    errorTokens.push_back(token);
+  } // for
+
+  apns::MockGateway gateway(options);
+
+  try {
+    gateway.start();
+  } // try
+  catch(const apns::MockGateway_Exception &e) {
+    expect(name, false, e.message());
+    return;
+  } // catch
+
+  {
+    apns::PushController push("127.0.0.1", gateway.pushPort(), certdir + "/client.pem", certdir + "/client.key", certdir, 60);
+
+    push.outcomeHandler(&outcomes);
+
+    for(unsigned int i = 0; i < numMessages; i++) {
+      // spread the error tokens through the run
+      const unsigned int slot = numErrorTokens ? i / (numMessages / numErrorTokens) : 0;
+      const bool errorToken = numErrorTokens && i % (numMessages / numErrorTokens) == 0 && slot < numErrorTokens;
+
+      apns::ApnsMessage *aMessage = new apns::ApnsMessage(errorToken ? errorTokens[slot] : push.generateRandomDeviceToken());
+      aMessage->text("mock check");
+      aMessage->maxRetries(maxRetries);
+      push.add(aMessage);
+    } // for
+
+    push.drain(time(NULL) + 60, unsent);
+
+    for(apns::PushController::messageQueueType::iterator ptr = unsent.begin(); ptr != unsent.end(); ptr++)
+      delete *ptr;
+  } // push
+
+  gateway.stop();
+
+  const unsigned int sent = outcomes.count[apns::OUTCOME_SENT];
+  const unsigned int failed = outcomes.count[apns::OUTCOME_FAILED];
+  const unsigned int exhausted = outcomes.count[apns::OUTCOME_RETRIES_EXHAUSTED];
+
+  std::cout << name << ": added(" << numMessages
+            << ") sent(" << sent
+            << ") failed(" << failed
+            << ") expired(" << outcomes.count[apns::OUTCOME_EXPIRED]
+            << ") retries-exhausted(" << exhausted
+            << ") dropped(" << outcomes.count[apns::OUTCOME_DROPPED]
+            << ") unsent(" << unsent.size()
+            << ") gateway errors(" << gateway.numErrors()
+            << ") drops(" << gateway.numDrops()
+            << ") frames(" << gateway.numFrames()
+            << ")" << std::endl;
+
+  expect(name, unsent.empty(), "messages left unsent");
+  expect(name, outcomes.total == numMessages, "outcomes reported != messages added");
+  expect(name, sent + failed + exhausted == numMessages, "sent + failed + retries exhausted != messages added");
+  if (!numErrorTokens && options.errorRate == 0)
+    expect(name, gateway.numFrames() <= numMessages * (maxRetries + 1), "a message was resent past maxRetries");
+  expect(name, failed >= numErrorTokens, "an error token was reported sent");
+  expect(name, failed == gateway.numErrors(), "failed != errors injected");
+} // checkRun
+
+int main(int argc, char **argv) {
+  apns::MockGatewayOptions options;
+
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <certdir>" << std::endl;
+    return 1;
+  } // if
+
+  signal(SIGPIPE, SIG_IGN);
+  apns::ApnsAbstract::logLevel(openframe::loglevel::LogCrit);
+
+  checkRun(argv[1], "clean", options, 2000, 0);
+  checkRun(argv[1], "error-tokens", options, 2000, 20);
+
+  options.errorRate = 0.01;
+  options.seed = 3;
+  checkRun(argv[1], "error-rate", options, 2000, 0);
+
+  options.errorRate = 0;
+  options.dropRate = 0.005;
+  options.seed = 5;
+  checkRun(argv[1], "drop-rate", options, 2000, 0);
+
+  // no retries at all: the gateway sees each message at most once
+  options.seed = 9;
+  checkRun(argv[1], "no-retries", options, 2000, 0, 0);
+
+  options.errorRate = 0.01;
+  options.seed = 7;
+  checkRun(argv[1], "error-and-drop-rate", options, 2000, 10);
+
+  return s_failed ? 1 : 0;
+} // main
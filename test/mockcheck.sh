@@ -0,0 +1,13 @@
+#!/bin/sh
+#
+# Run by make check: push through PushController to an in-process mock
+# gateway with throwaway certificates from gencerts.sh.  Skipped (77)
+# when the certificates can't be made, e.g. no openssl command.
+
+srcdir=${srcdir:-.}
+certdir=`mktemp -d "${TMPDIR:-/tmp}/apnscheck.XXXXXX"` || exit 1
+trap 'rm -rf "$certdir"' 0
+
+sh "$srcdir/gencerts.sh" "$certdir" >/dev/null || exit 77
+
+./mockcheck "$certdir"